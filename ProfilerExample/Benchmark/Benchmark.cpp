@@ -0,0 +1,539 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include "Profiler.h"
+#include "TimedEvent.h"
+#include "Timer.h"
+#include "NameRegistry.h"
+#include "MemoryPager.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/*
+* Microbenchmarks for the recording hot path: scope cost across nesting depths, thread counts,
+* record formats and name lengths, page allocation, allocation tracking, frame cleanup and sustained throughput.
+* Times are measured with steady_clock, so they don't depend on the profiler clock under test
+*/
+
+typedef std::chrono::steady_clock Clock;
+
+// Defined in BenchmarkDisabled.cpp, which is built with PROFILER_ENABLED 0
+double RunCompiledOutScopes(uint32_t count);
+
+volatile uint32_t g_sink;
+
+struct Options
+{
+  uint32_t scopes;          // scopes per configuration, split over the threads
+  uint32_t pages;           // live pages for the frame cleanup benchmark
+  uint32_t maxThreads;
+  uint32_t sustainedThreads;
+  double sustainedSeconds;
+};
+
+static double ElapsedNs(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+static double PeakMemoryMB()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return 0.0;
+  return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / (1024.0 * 1024.0); // bytes
+#else
+  return usage.ru_maxrss / 1024.0; // KB
+#endif
+#endif
+}
+
+static double PagerMemoryMB()
+{
+  return MemoryPager::Get()->GetNumPages() * (double)MemoryPager::kPageSize / (1024.0 * 1024.0);
+}
+
+static void PrintSection(const char* name)
+{
+  printf("\n%s\n", name);
+}
+
+// Per thread cost, and throughput of all threads together
+struct ScopeCost
+{
+  double nsPerScope;
+  double scopesPerSecond;
+};
+
+static void PrintScopeCost(const char* name, const ScopeCost& cost)
+{
+  printf("  %-40s %9.2f ns/scope %9.1f Mscopes/s\n", name, cost.nsPerScope, cost.scopesPerSecond / 1e6);
+}
+
+static void PrintCost(const char* name, double ns, const char* unit)
+{
+  printf("  %-40s %9.2f %s\n", name, ns, unit);
+}
+
+// Drops all recorded history, so earlier benchmarks don't add to the cost or memory of later ones
+static void ExpireHistory()
+{
+  Profiler* profiler = Profiler::Get();
+  unsigned long long historyTime = profiler->GetHistoryTime();
+  profiler->SetHistoryTime(0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  profiler->BeginFrame();
+  profiler->EndFrame();
+  profiler->SetHistoryTime(historyTime);
+}
+
+static void Nest(uint32_t nameID, uint32_t depth)
+{
+  TimedEvent ev(nameID);
+  if (depth > 1)
+    Nest(nameID, depth - 1);
+}
+
+/*
+* Runs record(count) on fresh threads that start together, so every run gets new event managers
+* Returns the average ns per scope seen by each thread, and the throughput over the whole run
+*/
+template<typename Record>
+static ScopeCost RunThreads(uint32_t threadCount, uint32_t scopesPerThread, Record record)
+{
+  std::atomic<uint32_t> ready(0);
+  std::atomic<bool> go(false);
+  std::vector<double> times(threadCount);
+  std::vector<std::thread> threads;
+
+  for (uint32_t i = 0; i < threadCount; i++)
+  {
+    threads.emplace_back([&, i]
+    {
+      record(64); // creates the thread's event manager and first page
+      ready.fetch_add(1);
+      while (!go.load(std::memory_order_acquire))
+        std::this_thread::yield();
+
+      Clock::time_point start = Clock::now();
+      record(scopesPerThread);
+      times[i] = ElapsedNs(start);
+    });
+  }
+
+  while (ready.load() < threadCount)
+    std::this_thread::yield();
+  Clock::time_point start = Clock::now();
+  go.store(true, std::memory_order_release);
+
+  for (auto& thread : threads)
+    thread.join();
+  double wallTime = ElapsedNs(start);
+
+  double total = 0.0;
+  for (double time : times)
+    total += time;
+
+  ScopeCost cost;
+  cost.nsPerScope = total / threadCount / scopesPerThread;
+  cost.scopesPerSecond = (double)threadCount * scopesPerThread / wallTime * 1e9;
+  return cost;
+}
+
+static void BenchmarkTimer(const Options& options)
+{
+  PrintSection("Timer");
+  uint32_t count = options.scopes * 5;
+
+  Timer::ClockSource sources[] = { Timer::kClockSteady, Timer::kClockTSC };
+  for (Timer::ClockSource source : sources)
+  {
+    Timer::Init(source);
+    if (source == Timer::kClockTSC && !Timer::IsUsingTSC())
+    {
+      printf("  TSC not invariant, skipped\n");
+      continue;
+    }
+    const char* clockName = Timer::IsUsingTSC() ? "TSC" : "steady_clock";
+    char name[64];
+
+    unsigned long long sum = 0;
+    Clock::time_point start = Clock::now();
+    for (uint32_t i = 0; i < count; i++)
+      sum += Timer::Now();
+    snprintf(name, sizeof(name), "%s Now", clockName);
+    PrintCost(name, ElapsedNs(start) / count, "ns/call");
+
+    start = Clock::now();
+    for (uint32_t i = 0; i < count; i++)
+      sum += Timer::NowSerialized();
+    snprintf(name, sizeof(name), "%s NowSerialized", clockName);
+    PrintCost(name, ElapsedNs(start) / count, "ns/call");
+    g_sink = (uint32_t)sum;
+  }
+
+  Timer::Init();
+  printf("  using %s\n", Timer::IsUsingTSC() ? "TSC" : "steady_clock");
+}
+
+static void BenchmarkDisabled(const Options& options)
+{
+  PrintSection("Disabled scopes");
+  uint32_t count = options.scopes * 50;
+
+  PrintCost("compiled out (PROFILER_ENABLED 0)", RunCompiledOutScopes(count), "ns/scope");
+
+  TimedEvent::SetCaptureEnabled(false);
+  Clock::time_point start = Clock::now();
+  for (uint32_t i = 0; i < count; i++)
+  {
+    SCOPED_EVENT(RuntimeDisabled);
+    g_sink = i;
+  }
+  PrintCost("runtime disabled (SetCaptureEnabled)", ElapsedNs(start) / count, "ns/scope");
+  TimedEvent::SetCaptureEnabled(true);
+}
+
+static void BenchmarkPager(const Options& options)
+{
+  PrintSection("MemoryPager");
+  static const uint32_t kBatchSize = 256;
+  uint32_t rounds = options.scopes / 20000 + 1;
+
+  MemoryPager* pager = MemoryPager::Get();
+  std::vector<MemoryPager::Page*> pages(kBatchSize);
+  double getTime = 0.0;
+  double releaseTime = 0.0;
+
+  // The first round allocates the pages, later ones recycle them through the free list
+  for (uint32_t round = 0; round <= rounds; round++)
+  {
+    Clock::time_point start = Clock::now();
+    for (uint32_t i = 0; i < kBatchSize; i++)
+      pages[i] = pager->GetPage();
+    double time = ElapsedNs(start);
+
+    if (round == 0)
+      PrintCost("GetPage, allocating", time / kBatchSize, "ns/page");
+    else
+      getTime += time;
+
+    start = Clock::now();
+    for (uint32_t i = 0; i < kBatchSize; i++)
+      pager->ReleasePage(pages[i]);
+    if (round != 0)
+      releaseTime += ElapsedNs(start);
+  }
+
+  PrintCost("GetPage, recycled", getTime / (rounds * kBatchSize), "ns/page");
+  PrintCost("ReleasePage", releaseTime / (rounds * kBatchSize), "ns/page");
+}
+
+static void BenchmarkScopes(const Options& options)
+{
+  Profiler* profiler = Profiler::Get();
+  uint32_t nameID = NameRegistry::Get()->Register("BenchmarkScope", 0);
+  char name[64];
+
+  PrintSection("Scope cost by nesting depth, 1 thread");
+  uint32_t depths[] = { 1, 4, 16, 64 };
+  for (uint32_t depth : depths)
+  {
+    ScopeCost cost = RunThreads(1, options.scopes, [&](uint32_t count)
+    {
+      for (uint32_t i = 0; i < count / depth; i++)
+        Nest(nameID, depth);
+    });
+    snprintf(name, sizeof(name), "depth %u", depth);
+    PrintScopeCost(name, cost);
+    ExpireHistory();
+  }
+
+  PrintSection("Scope cost by thread count, depth 4");
+  std::vector<uint32_t> threadCounts;
+  for (uint32_t threadCount = 1; threadCount < options.maxThreads; threadCount *= 2)
+    threadCounts.push_back(threadCount);
+  threadCounts.push_back(options.maxThreads);
+
+  for (uint32_t threadCount : threadCounts)
+  {
+    uint32_t scopesPerThread = options.scopes / threadCount;
+    ScopeCost cost = RunThreads(threadCount, scopesPerThread, [&](uint32_t count)
+    {
+      for (uint32_t i = 0; i < count / 4; i++)
+        Nest(nameID, 4);
+    });
+    snprintf(name, sizeof(name), "%u thread%s", threadCount, threadCount > 1 ? "s" : "");
+    PrintScopeCost(name, cost);
+    ExpireHistory();
+  }
+
+  PrintSection("Scope cost by record format, depth 4");
+  ProfilerEventManager::RecordFormat formats[] = { ProfilerEventManager::kRecordEvents, ProfilerEventManager::kRecordStream, ProfilerEventManager::kRecordCounters };
+  PerfCounters counterProbe;
+  bool hasCounters = counterProbe.Open();
+  counterProbe.Close();
+  for (ProfilerEventManager::RecordFormat format : formats)
+  {
+    profiler->SetRecordFormat(format);
+    ScopeCost cost = RunThreads(1, options.scopes, [&](uint32_t count)
+    {
+      for (uint32_t i = 0; i < count / 4; i++)
+        Nest(nameID, 4);
+    });
+    const char* formatName = format == ProfilerEventManager::kRecordStream ? "kRecordStream" : format == ProfilerEventManager::kRecordEvents ? "kRecordEvents" :
+      hasCounters ? "kRecordCounters" : "kRecordCounters (no PMU, kRecordEvents)";
+    PrintScopeCost(formatName, cost);
+    ExpireHistory();
+  }
+  profiler->SetRecordFormat(ProfilerEventManager::kRecordEvents);
+
+  // Macros register their name once per call site, so only registering per event depends on the length
+  PrintSection("Scope cost by name length, 1 thread");
+  uint32_t lengths[] = { 8, 32, 63 };
+  for (uint32_t length : lengths)
+  {
+    std::string eventName = "Event";
+    eventName.resize(length, 'x');
+    uint32_t lengthNameID = NameRegistry::Get()->Register(eventName.c_str(), 0);
+
+    ScopeCost cost = RunThreads(1, options.scopes, [&](uint32_t count)
+    {
+      for (uint32_t i = 0; i < count; i++)
+        TimedEvent ev(lengthNameID);
+    });
+    snprintf(name, sizeof(name), "%u chars, registered once", length);
+    PrintScopeCost(name, cost);
+
+    cost = RunThreads(1, options.scopes / 10, [&](uint32_t count)
+    {
+      for (uint32_t i = 0; i < count; i++)
+        TimedEvent ev(0, eventName.c_str());
+    });
+    snprintf(name, sizeof(name), "%u chars, registered per event", length);
+    PrintScopeCost(name, cost);
+    ExpireHistory();
+  }
+}
+
+// malloc and free with the tracker hooks, sizes cycle through 16 bytes to 4 KB
+static double RunAllocations(uint32_t count)
+{
+  std::vector<void*> live(64, nullptr);
+  Clock::time_point start = Clock::now();
+  for (uint32_t i = 0; i < count; i++)
+  {
+    void* &slot = live[i & 63];
+    if (slot != nullptr)
+    {
+      PROFILER_FREE(slot);
+      free(slot);
+    }
+    size_t size = (size_t)16 << (i % 9);
+    slot = malloc(size);
+    PROFILER_ALLOC(slot, size);
+  }
+  double time = ElapsedNs(start) / count;
+
+  for (auto it = live.begin(); it != live.end(); it++)
+  {
+    PROFILER_FREE(*it);
+    free(*it);
+  }
+  return time;
+}
+
+static void BenchmarkAllocations(const Options& options)
+{
+  PrintSection("Allocation tracking, malloc + free, 16 B to 4 KB");
+  uint32_t count = options.scopes;
+  AllocationTracker* tracker = AllocationTracker::Get();
+
+  PrintCost("tracker disabled", RunAllocations(count), "ns/alloc");
+
+  char name[64];
+  uint64_t intervals[] = { AllocationTracker::kDefaultSampleInterval, 1024 * 1024, 0 };
+  for (uint64_t interval : intervals)
+  {
+    tracker->Enable(interval);
+    double time = RunAllocations(count);
+    tracker->Disable();
+
+    if (interval == 0)
+      snprintf(name, sizeof(name), "every allocation");
+    else
+      snprintf(name, sizeof(name), "sampled every %llu KB", (unsigned long long)interval / 1024);
+    PrintCost(name, time, "ns/alloc");
+    ExpireHistory();
+  }
+}
+
+static void BenchmarkFrameCleanup(const Options& options)
+{
+  Profiler* profiler = Profiler::Get();
+  uint32_t nameID = NameRegistry::Get()->Register("BenchmarkCleanup", 0);
+  static const uint32_t kFrames = 100;
+  char name[64];
+
+  PrintSection("Frame cleanup (ClearOutdatedEvents)");
+
+  // Fill the requested number of pages from this thread, it stays alive so the pages stay live
+  uint32_t eventsPerPage = MemoryPager::kPageSize / sizeof(ProfilerEventManager::ProfilerEvent);
+  for (uint64_t i = 0; i < (uint64_t)options.pages * eventsPerPage; i++)
+    Nest(nameID, 1);
+
+  Clock::time_point start = Clock::now();
+  for (uint32_t i = 0; i < kFrames; i++)
+  {
+    profiler->BeginFrame();
+    profiler->EndFrame();
+  }
+  snprintf(name, sizeof(name), "frame, %u live pages", options.pages);
+  PrintCost(name, ElapsedNs(start) / kFrames / 1e3, "us/frame");
+
+  // Expire everything at once, which releases all but the page still being written to
+  unsigned long long historyTime = profiler->GetHistoryTime();
+  profiler->SetHistoryTime(0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  start = Clock::now();
+  profiler->BeginFrame();
+  double expireTime = ElapsedNs(start);
+  profiler->EndFrame();
+  profiler->SetHistoryTime(historyTime);
+
+  snprintf(name, sizeof(name), "frame expiring %u pages", options.pages);
+  PrintCost(name, expireTime / 1e3, "us/frame");
+  PrintCost("expiry per page", expireTime / options.pages, "ns/page");
+}
+
+static void BenchmarkSustained(const Options& options)
+{
+  static const unsigned long long kHistoryTime = 100000000; // 100 ms, bounds the memory a full speed recording needs
+  Profiler* profiler = Profiler::Get();
+  uint32_t nameID = NameRegistry::Get()->Register("BenchmarkSustained", 0);
+
+  char section[128];
+  snprintf(section, sizeof(section), "Sustained recording, %u thread%s, depth 4, 60 Hz frames, %llu ms history", options.sustainedThreads, options.sustainedThreads > 1 ? "s" : "", kHistoryTime / 1000000);
+  PrintSection(section);
+
+  unsigned long long historyTime = profiler->GetHistoryTime();
+  profiler->SetHistoryTime(kHistoryTime);
+
+  std::atomic<bool> stop(false);
+  std::atomic<unsigned long long> totalScopes(0);
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < options.sustainedThreads; i++)
+  {
+    threads.emplace_back([&]
+    {
+      unsigned long long scopes = 0;
+      while (!stop.load(std::memory_order_relaxed))
+      {
+        for (uint32_t j = 0; j < 256; j++)
+          Nest(nameID, 4);
+        scopes += 256 * 4;
+      }
+      totalScopes.fetch_add(scopes);
+    });
+  }
+
+  // This thread plays the frame thread, expiring history like an application would
+  Clock::time_point start = Clock::now();
+  while (ElapsedNs(start) < options.sustainedSeconds * 1e9)
+  {
+    profiler->BeginFrame();
+    std::this_thread::sleep_for(std::chrono::microseconds(16667));
+    profiler->EndFrame();
+  }
+  stop.store(true);
+  for (auto& thread : threads)
+    thread.join();
+  double seconds = ElapsedNs(start) / 1e9;
+
+  profiler->SetHistoryTime(historyTime);
+  ExpireHistory();
+
+  printf("  %-40s %9.1f Mevents/s\n", "events recorded", totalScopes.load() / seconds / 1e6);
+}
+
+static void PrintUsage()
+{
+  printf("Usage: ProfilerBenchmark [--quick] [--scopes N] [--pages N] [--threads N] [--seconds S]\n");
+  printf("  --quick      short run, for smoke testing\n");
+  printf("  --scopes N   scopes recorded per configuration (default 2000000)\n");
+  printf("  --pages N    live pages for the frame cleanup benchmark (default 1000, 256 KB each)\n");
+  printf("               --pages 10000 is a full 10 second history at 250 MB/s, it needs 2.5 GB\n");
+  printf("  --threads N  highest thread count (default: hardware threads)\n");
+  printf("  --seconds S  length of the sustained recording (default 2)\n");
+}
+
+int main(int argc, char** argv)
+{
+  uint32_t hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  Options options;
+  options.scopes = 2000000;
+  options.pages = 1000;
+  options.maxThreads = hardwareThreads;
+  options.sustainedThreads = std::min(hardwareThreads, 4u);
+  options.sustainedSeconds = 2.0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "--quick") == 0)
+    {
+      options.scopes = 200000;
+      options.pages = 100;
+      options.sustainedSeconds = 0.5;
+    }
+    else if (strcmp(argv[i], "--scopes") == 0 && hasValue)
+      options.scopes = std::max(atoi(argv[++i]), 1024);
+    else if (strcmp(argv[i], "--pages") == 0 && hasValue)
+      options.pages = std::max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "--threads") == 0 && hasValue)
+      options.maxThreads = options.sustainedThreads = std::max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "--seconds") == 0 && hasValue)
+      options.sustainedSeconds = atof(argv[++i]);
+    else
+    {
+      PrintUsage();
+      return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+    }
+  }
+
+  printf("ProfilerBenchmark: %u scopes per configuration, %u hardware threads\n", options.scopes, hardwareThreads);
+
+  // The timer benchmark re-initializes the clock, so it runs before anything gets recorded
+  BenchmarkTimer(options);
+  BenchmarkDisabled(options);
+  BenchmarkPager(options);
+  BenchmarkScopes(options);
+  BenchmarkAllocations(options);
+  BenchmarkFrameCleanup(options);
+  BenchmarkSustained(options);
+
+  PrintSection("Memory");
+  PrintCost("peak resident", PeakMemoryMB(), "MB");
+  PrintCost("pages allocated by the pager", PagerMemoryMB(), "MB");
+  return 0;
+}
@@ -0,0 +1,19 @@
+// Built with the event macros compiled out, to measure what disabled scopes cost
+#define PROFILER_ENABLED 0
+
+#include <stdint.h>
+#include <chrono>
+#include "TimedEvent.h"
+
+volatile uint32_t g_compiledOutSink;
+
+double RunCompiledOutScopes(uint32_t count)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < count; i++)
+  {
+    SCOPED_EVENT(CompiledOut);
+    g_compiledOutSink = i; // same loop body as the runtime disabled benchmark
+  }
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
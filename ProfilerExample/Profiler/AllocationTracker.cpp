@@ -0,0 +1,175 @@
+#include <math.h>
+#include "AllocationTracker.h"
+#include "Profiler.h"
+
+AllocationTracker AllocationTracker::s_tracker;
+thread_local bool AllocationTracker::s_inTracker = false;
+
+static uint32_t HashAddress(uint64_t address)
+{
+  // Allocations are at least 8 byte aligned, Fibonacci hashing spreads the rest
+  return (uint32_t)(((address >> 3) * 0x9E3779B97F4A7C15ull) >> 32) & (AllocationTracker::kTableSize - 1);
+}
+
+AllocationTracker::AllocationTracker()
+  : m_enabled(false), m_sampleInterval(kDefaultSampleInterval), m_table(nullptr), m_moveSequence(0), m_liveBytes(0), m_droppedAllocations(0)
+{
+}
+
+void AllocationTracker::Enable(uint64_t sampleInterval)
+{
+  if (m_table == nullptr)
+  {
+    s_inTracker = true;
+    m_table = new Slot[kTableSize];
+    for (uint32_t i = 0; i < kTableSize; i++)
+    {
+      m_table[i].address.store(kEmptySlot, std::memory_order_relaxed);
+      m_table[i].bytes.store(0, std::memory_order_relaxed);
+    }
+    s_inTracker = false;
+  }
+
+  m_sampleInterval.store(sampleInterval, std::memory_order_relaxed);
+  m_enabled.store(true, std::memory_order_release);
+}
+
+bool AllocationTracker::InsertAllocation(uint64_t address, unsigned long long bytes)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  uint32_t slot = HashAddress(address);
+  for (uint32_t probe = 0; probe < kMaxProbes; probe++, slot = (slot + 1) & (kTableSize - 1))
+  {
+    if (m_table[slot].address.load(std::memory_order_relaxed) != kEmptySlot)
+      continue;
+
+    m_table[slot].bytes.store(bytes, std::memory_order_relaxed);
+    m_table[slot].address.store(address, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+uint32_t AllocationTracker::FindAllocation(uint64_t address)
+{
+  uint32_t slot = HashAddress(address);
+  for (uint32_t probe = 0; probe < kMaxProbes; probe++, slot = (slot + 1) & (kTableSize - 1))
+  {
+    uint64_t current = m_table[slot].address.load(std::memory_order_acquire);
+    if (current == address)
+      return slot;
+    if (current == kEmptySlot)
+      break;
+  }
+  return kTableSize;
+}
+
+bool AllocationTracker::RemoveAllocation(uint64_t address, unsigned long long& bytes)
+{
+  // Most frees weren't sampled and only look the address up. A removal moving slots back at the same time
+  // could hide the address from the lookup, so it's repeated if one ran
+  for (;;)
+  {
+    uint32_t sequence = m_moveSequence.load(std::memory_order_acquire);
+    if (FindAllocation(address) != kTableSize)
+      break;
+    if ((sequence & 1) == 0 && sequence == m_moveSequence.load(std::memory_order_relaxed))
+      return false;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  uint32_t hole = FindAllocation(address);
+  if (hole == kTableSize)
+    return false;
+  bytes = m_table[hole].bytes.load(std::memory_order_relaxed);
+
+  // Backward shift deletion: the following slots of the probe sequence move into the hole when that keeps them
+  // at or after their hash, so removals leave no markers behind that later lookups would have to probe past
+  uint32_t sequence = m_moveSequence.load(std::memory_order_relaxed);
+  m_moveSequence.store(sequence + 1, std::memory_order_relaxed);
+  uint32_t slot = hole;
+  for (uint32_t i = 1; i < kTableSize; i++)
+  {
+    slot = (slot + 1) & (kTableSize - 1);
+    uint64_t current = m_table[slot].address.load(std::memory_order_relaxed);
+    if (current == kEmptySlot)
+      break;
+    if (((slot - HashAddress(current)) & (kTableSize - 1)) < ((slot - hole) & (kTableSize - 1)))
+      continue;
+
+    // A lookup that sees the moved address sees the odd sequence as well
+    m_table[hole].bytes.store(m_table[slot].bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_table[hole].address.store(current, std::memory_order_release);
+    hole = slot;
+  }
+  m_table[hole].address.store(kEmptySlot, std::memory_order_release);
+  m_moveSequence.store(sequence + 2, std::memory_order_release);
+  return true;
+}
+
+void AllocationTracker::OnAlloc(void* address, size_t size)
+{
+  if (!m_enabled.load(std::memory_order_acquire) || address == nullptr || size == 0 || s_inTracker)
+    return;
+
+  // Exiting threads have no manager anymore, their allocations aren't recorded
+  s_inTracker = true;
+  ProfilerEventManager* mngr = Profiler::Get()->GetEventManager();
+  if (mngr == nullptr)
+  {
+    s_inTracker = false;
+    return;
+  }
+
+  // Most allocations only count down the bytes to the next sample
+  unsigned long long bytes = size;
+  uint64_t interval = m_sampleInterval.load(std::memory_order_relaxed);
+  if (interval > 0)
+  {
+    mngr->m_allocCountdown -= (long long)size;
+    if (mngr->m_allocCountdown > 0)
+    {
+      s_inTracker = false;
+      return;
+    }
+
+    // Exponentially distributed distances make every byte equally likely to be sampled,
+    // so an allocation of size s gets sampled with probability 1 - e^(-s / interval)
+    mngr->m_allocRandom ^= mngr->m_allocRandom << 13;
+    mngr->m_allocRandom ^= mngr->m_allocRandom >> 7;
+    mngr->m_allocRandom ^= mngr->m_allocRandom << 17;
+    double uniform = ((mngr->m_allocRandom >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+    mngr->m_allocCountdown = (long long)(-log(uniform) * (double)interval) + 1;
+
+    double probability = -expm1(-(double)size / (double)interval);
+    bytes = (unsigned long long)((double)size / probability + 0.5);
+  }
+
+  if (InsertAllocation((uint64_t)(uintptr_t)address, bytes))
+  {
+    long long liveBytes = m_liveBytes.fetch_add((long long)bytes, std::memory_order_relaxed) + (long long)bytes;
+    mngr->AddAllocation(ProfilerEventManager::kAlloc, (uint64_t)(uintptr_t)address, bytes, liveBytes);
+  }
+  else
+    m_droppedAllocations.fetch_add(1, std::memory_order_relaxed);
+
+  s_inTracker = false;
+}
+
+void AllocationTracker::OnFree(void* address)
+{
+  // Frees of allocations that weren't sampled only cost a lookup, without the lock
+  if (!m_enabled.load(std::memory_order_acquire) || address == nullptr || s_inTracker)
+    return;
+
+  unsigned long long bytes = 0;
+  if (!RemoveAllocation((uint64_t)(uintptr_t)address, bytes))
+    return;
+
+  s_inTracker = true;
+  long long liveBytes = m_liveBytes.fetch_sub((long long)bytes, std::memory_order_relaxed) - (long long)bytes;
+  ProfilerEventManager* mngr = Profiler::Get()->GetEventManager();
+  if (mngr != nullptr)
+    mngr->AddAllocation(ProfilerEventManager::kFree, (uint64_t)(uintptr_t)address, bytes, liveBytes);
+  s_inTracker = false;
+}
@@ -0,0 +1,67 @@
+#ifndef _ALLOCATION_TRACKER_H
+#define _ALLOCATION_TRACKER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+
+/*
+* Records allocations and frees into the calling thread's event manager (see ProfilerEventManager::AllocRecord)
+* Allocations are sampled by bytes, on average one per sample interval gets recorded and stands for the bytes of
+* the ones that weren't. Frees are only recorded for sampled allocations, which are kept in a fixed size address table.
+* Inserts and removals take a lock, the lookups of all other frees don't
+* Call OnAlloc and OnFree from the application's allocator, or use the PROFILER_ALLOC / PROFILER_FREE macros
+*/
+class AllocationTracker
+{
+public:
+  static const uint64_t kDefaultSampleInterval = 64 * 1024; // in bytes
+  static const uint32_t kTableSize = 1 << 18; // sampled allocations that can be live at once
+  static const uint32_t kMaxProbes = 64;
+
+  static AllocationTracker* Get() { return &s_tracker; }
+
+  // An interval of 0 records every allocation. Allocations made while disabled are never recorded as freed
+  void Enable(uint64_t sampleInterval = kDefaultSampleInterval);
+  void Disable() { m_enabled.store(false, std::memory_order_relaxed); }
+  bool IsEnabled() { return m_enabled.load(std::memory_order_relaxed); }
+  uint64_t GetSampleInterval() { return m_sampleInterval.load(std::memory_order_relaxed); }
+
+  // Estimated from the sampled allocations that are still live
+  long long GetLiveBytes() { return m_liveBytes.load(std::memory_order_relaxed); }
+  // Sampled allocations that didn't find a slot in the table, they're left out
+  uint32_t GetDroppedAllocations() { return m_droppedAllocations.load(std::memory_order_relaxed); }
+
+  void OnAlloc(void* address, size_t size);
+  void OnFree(void* address);
+
+private:
+  static const uint64_t kEmptySlot = 0;
+
+  struct Slot
+  {
+    std::atomic<uint64_t> address;
+    std::atomic<unsigned long long> bytes; // estimated bytes the allocation stands for
+  };
+
+  AllocationTracker();
+
+  bool InsertAllocation(uint64_t address, unsigned long long bytes);
+  bool RemoveAllocation(uint64_t address, unsigned long long& bytes);
+  // Returns kTableSize if the address isn't in the table
+  uint32_t FindAllocation(uint64_t address);
+
+  static AllocationTracker s_tracker;
+  static thread_local bool s_inTracker; // the profiler allocates too, those allocations aren't tracked
+
+  std::atomic<bool> m_enabled;
+  std::atomic<uint64_t> m_sampleInterval;
+  Slot* m_table; // allocated by the first Enable and never freed, frees may look it up at any time
+  std::mutex m_mutex; // held to insert and remove
+  std::atomic<uint32_t> m_moveSequence; // odd while a removal moves slots back, lookups retry if it changed
+  std::atomic<long long> m_liveBytes;
+  std::atomic<uint32_t> m_droppedAllocations;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include "CallTree.h"
+
+static uint32_t HashSlot(uint64_t key, uint32_t bits)
+{
+  return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> (64 - bits));
+}
+
+CallTreeBuilder::CallTreeBuilder() : m_childTableBits(10)
+{
+  ChildSlot empty = { kEmptyKey, 0 };
+  m_childTable.resize(1u << m_childTableBits, empty);
+
+  CallTreeNode root = {};
+  root.parent = root.firstChild = root.nextSibling = CallTreeNode::kInvalidNode;
+  m_nodes.push_back(root);
+  m_lastChild.push_back((uint32_t)CallTreeNode::kInvalidNode);
+}
+
+uint32_t CallTreeBuilder::GetChild(uint32_t parent, uint32_t nameID)
+{
+  uint32_t lastChild = m_lastChild[parent];
+  if (lastChild != CallTreeNode::kInvalidNode && m_nodes[lastChild].nameID == nameID)
+    return lastChild;
+
+  uint64_t key = ((uint64_t)parent << 32) | nameID;
+  uint32_t mask = (1u << m_childTableBits) - 1;
+  uint32_t slot = HashSlot(key, m_childTableBits);
+  while (m_childTable[slot].key != key && m_childTable[slot].key != kEmptyKey)
+    slot = (slot + 1) & mask;
+
+  uint32_t child;
+  if (m_childTable[slot].key == key)
+    child = m_childTable[slot].node;
+  else
+  {
+    child = (uint32_t)m_nodes.size();
+    m_childTable[slot].key = key;
+    m_childTable[slot].node = child;
+
+    CallTreeNode node = {};
+    node.nameID = nameID;
+    node.parent = parent;
+    node.firstChild = CallTreeNode::kInvalidNode;
+    node.nextSibling = m_nodes[parent].firstChild;
+    node.depth = m_nodes[parent].depth + 1;
+    m_nodes[parent].firstChild = child;
+
+    m_nodes.push_back(node);
+    m_lastChild.push_back((uint32_t)CallTreeNode::kInvalidNode);
+
+    // Every node but the root has a slot
+    if (m_nodes.size() * 2 > m_childTable.size())
+      GrowChildTable();
+  }
+
+  m_lastChild[parent] = child;
+  return child;
+}
+
+void CallTreeBuilder::GrowChildTable()
+{
+  std::vector<ChildSlot> oldTable;
+  oldTable.swap(m_childTable);
+
+  m_childTableBits++;
+  uint32_t mask = (1u << m_childTableBits) - 1;
+  ChildSlot empty = { kEmptyKey, 0 };
+  m_childTable.resize(1u << m_childTableBits, empty);
+
+  for (auto it = oldTable.begin(); it != oldTable.end(); it++)
+  {
+    if (it->key == kEmptyKey)
+      continue;
+
+    uint32_t slot = HashSlot(it->key, m_childTableBits);
+    while (m_childTable[slot].key != kEmptyKey)
+      slot = (slot + 1) & mask;
+    m_childTable[slot] = *it;
+  }
+}
+
+void CallTreeBuilder::AddEvent(unsigned long long startTime, unsigned long long duration, uint32_t nameID, uint32_t depth)
+{
+  // Nest into the last event one level up if it's still running, events whose parent isn't in the capture become top level
+  uint32_t parent = CallTreeNode::kRoot;
+  if (depth > 0 && depth - 1 < m_openNodes.size() && startTime < m_openNodes[depth - 1].endTime)
+    parent = m_openNodes[depth - 1].node;
+
+  uint32_t node = GetChild(parent, nameID);
+  m_nodes[node].count++;
+  m_nodes[node].inclusiveTime += duration;
+  m_nodes[node].exclusiveTime += duration;
+  m_nodes[parent].exclusiveTime -= duration;
+  if (parent == CallTreeNode::kRoot)
+    m_nodes[parent].inclusiveTime += duration;
+
+  if (depth >= m_openNodes.size())
+  {
+    OpenNode empty = { CallTreeNode::kRoot, 0 };
+    m_openNodes.resize(depth + 1, empty);
+  }
+  OpenNode open = { node, startTime + duration };
+  m_openNodes[depth] = open;
+}
+
+void CallTreeBuilder::Finish(std::vector<CallTreeNode>& nodes)
+{
+  // The root only adds up the top level events
+  m_nodes[CallTreeNode::kRoot].exclusiveTime = 0;
+
+  // Relink the children of every node by inclusive time
+  std::vector<uint32_t> children;
+  for (uint32_t i = 0; i < m_nodes.size(); i++)
+  {
+    children.clear();
+    for (uint32_t child = m_nodes[i].firstChild; child != CallTreeNode::kInvalidNode; child = m_nodes[child].nextSibling)
+      children.push_back(child);
+    if (children.size() < 2)
+      continue;
+
+    std::sort(children.begin(), children.end(), [this](uint32_t a, uint32_t b) { return m_nodes[a].inclusiveTime > m_nodes[b].inclusiveTime; });
+    m_nodes[i].firstChild = children[0];
+    for (size_t c = 0; c + 1 < children.size(); c++)
+      m_nodes[children[c]].nextSibling = children[c + 1];
+    m_nodes[children.back()].nextSibling = CallTreeNode::kInvalidNode;
+  }
+
+  nodes.swap(m_nodes);
+  m_nodes.clear();
+  m_lastChild.clear();
+  m_childTable.clear();
+}
@@ -0,0 +1,62 @@
+#ifndef _CALL_TREE_H
+#define _CALL_TREE_H
+
+#include <stdint.h>
+#include <vector>
+
+// Events merged by their name path, times are in timer ticks
+struct CallTreeNode
+{
+  static const uint32_t kRoot = 0;
+  static const uint32_t kInvalidNode = 0xFFFFFFFF;
+
+  uint32_t nameID;      // unused for the root
+  uint32_t parent;
+  uint32_t firstChild;  // children are sorted by inclusive time, largest first
+  uint32_t nextSibling;
+  uint32_t depth;       // 0 for the root, its children are the top level events
+  uint32_t count;       // number of merged events
+  unsigned long long inclusiveTime;
+  unsigned long long exclusiveTime;
+};
+
+/*
+* Merges the events of all threads into one call tree, in a single pass over each thread's events
+* Events of a thread have to be added in start order, parents before children that start at the same time
+*/
+class CallTreeBuilder
+{
+public:
+  CallTreeBuilder();
+
+  void BeginThread() { m_openNodes.clear(); }
+  void AddEvent(unsigned long long startTime, unsigned long long duration, uint32_t nameID, uint32_t depth);
+  void Finish(std::vector<CallTreeNode>& nodes); // sorts the children, nodes[CallTreeNode::kRoot] is the root
+
+private:
+  // Node the last event at a depth was merged into, later events nest into it while it's running
+  struct OpenNode
+  {
+    uint32_t node;
+    unsigned long long endTime;
+  };
+
+  // Open addressing table from (parent, name ID) to the child node, kept at most half full
+  struct ChildSlot
+  {
+    uint64_t key; // parent node in the upper, name ID in the lower 32 bits
+    uint32_t node;
+  };
+  static const uint64_t kEmptyKey = ~0ull; // the parent is never kInvalidNode
+
+  uint32_t GetChild(uint32_t parent, uint32_t nameID);
+  void GrowChildTable();
+
+  std::vector<CallTreeNode> m_nodes;
+  std::vector<uint32_t> m_lastChild; // per node, the child returned by the last lookup. Repeated calls skip the table
+  std::vector<ChildSlot> m_childTable;
+  uint32_t m_childTableBits;
+  std::vector<OpenNode> m_openNodes;
+};
+
+#endif
@@ -0,0 +1,496 @@
+#include <string.h>
+#include "CaptureFile.h"
+#include "NameRegistry.h"
+#include "Timer.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace CaptureFile;
+
+//******************************************************
+//                Capture File Writer
+//******************************************************
+CaptureFileWriter::CaptureFileWriter()
+  : m_file(nullptr), m_blockType(kBlockNames), m_blockThreadIndex(0), m_lastTime(0), m_numNamesWritten(0), m_bytesWritten(0)
+{
+}
+
+CaptureFileWriter::~CaptureFileWriter()
+{
+  Close();
+}
+
+bool CaptureFileWriter::Open(const char* path)
+{
+  Close();
+
+#ifdef _MSC_VER
+  if (fopen_s(&m_file, path, "wb") != 0)
+    m_file = nullptr;
+#else
+  m_file = fopen(path, "wb");
+#endif
+  if (m_file == nullptr)
+    return false;
+
+  // Blocks are small compared to the buffer, so they get written to disk in batches
+  setvbuf(m_file, nullptr, _IOFBF, kMaxBlockSize);
+
+  m_numNamesWritten = 0;
+  m_bytesWritten = 0;
+  m_block.reserve(kMaxBlockSize + 64);
+
+  // The header is written like a block payload, then flushed directly
+  m_block.clear();
+  WriteU32(kMagic);
+  WriteU32(kVersion);
+  WriteU64(Timer::NsToTicks(1e9));
+  fwrite(m_block.data(), 1, m_block.size(), m_file);
+  m_bytesWritten += m_block.size();
+  m_block.clear();
+
+  return true;
+}
+
+bool CaptureFileWriter::Close()
+{
+  if (m_file == nullptr)
+    return false;
+
+  bool success = ferror(m_file) == 0;
+  success &= fclose(m_file) == 0;
+  m_file = nullptr;
+  return success;
+}
+
+void CaptureFileWriter::WriteNewNames()
+{
+  uint32_t numNames = NameRegistry::Get()->GetNumNames();
+  if (m_numNamesWritten >= numNames)
+    return;
+
+  BeginBlock(kBlockNames);
+  for (uint32_t id = m_numNamesWritten; id < numNames; id++)
+  {
+    const char* name = NameRegistry::Get()->GetName(id);
+    size_t length = strlen(name);
+
+    WriteVarint(id);
+    WriteU32(NameRegistry::Get()->GetColor(id));
+    WriteVarint(length);
+    WriteBytes(name, length);
+  }
+  EndBlock();
+
+  m_numNamesWritten = numNames;
+}
+
+void CaptureFileWriter::WriteThread(uint32_t threadIndex, uint32_t threadID, const char* name)
+{
+  size_t length = strlen(name);
+
+  BeginBlock(kBlockThread);
+  WriteVarint(threadIndex);
+  WriteVarint(threadID);
+  WriteVarint(length);
+  WriteBytes(name, length);
+  EndBlock();
+}
+
+void CaptureFileWriter::WriteCaptureTime(unsigned long long captureTime)
+{
+  BeginBlock(kBlockCaptureTime);
+  WriteU64(captureTime);
+  EndBlock();
+}
+
+void CaptureFileWriter::BeginEvents(uint32_t threadIndex)
+{
+  m_blockThreadIndex = threadIndex;
+  BeginBlock(kBlockEvents);
+  WriteVarint(threadIndex);
+}
+
+void CaptureFileWriter::WriteEvent(unsigned long long startTime, unsigned long long duration, uint32_t nameID, uint32_t depth)
+{
+  // Continue in a new block once this one is full, so the block buffer stays small
+  if (m_block.size() >= kMaxBlockSize)
+  {
+    EndBlock();
+    BeginEvents(m_blockThreadIndex);
+  }
+
+  WriteTimeDelta(startTime);
+  WriteVarint(duration);
+  WriteVarint(nameID);
+  WriteVarint(depth);
+}
+
+void CaptureFileWriter::BeginTokens(uint32_t threadIndex)
+{
+  m_blockThreadIndex = threadIndex;
+  BeginBlock(kBlockTokens);
+  WriteVarint(threadIndex);
+}
+
+void CaptureFileWriter::WriteToken(unsigned long long timestamp, uint32_t nameID, uint32_t depth, bool isEnd)
+{
+  if (m_block.size() >= kMaxBlockSize)
+  {
+    EndBlock();
+    BeginTokens(m_blockThreadIndex);
+  }
+
+  WriteTimeDelta(timestamp);
+  WriteVarint(((uint64_t)depth << 1) | (isEnd ? 1 : 0));
+  if (!isEnd)
+    WriteVarint(nameID);
+}
+
+void CaptureFileWriter::BeginFrames()
+{
+  BeginBlock(kBlockFrames);
+}
+
+void CaptureFileWriter::WriteFrame(unsigned long long startTime, unsigned long long duration, uint32_t color)
+{
+  if (m_block.size() >= kMaxBlockSize)
+  {
+    EndBlock();
+    BeginFrames();
+  }
+
+  WriteTimeDelta(startTime);
+  WriteVarint(duration);
+  WriteU32(color);
+}
+
+void CaptureFileWriter::BeginBlock(BlockType type)
+{
+  m_blockType = type;
+  m_lastTime = 0;
+  m_block.clear();
+}
+
+void CaptureFileWriter::EndBlock()
+{
+  if (m_file == nullptr)
+    return;
+
+  uint8_t header[8];
+  for (int i = 0; i < 4; i++)
+  {
+    header[i] = (uint8_t)((uint32_t)m_blockType >> (i * 8));
+    header[4 + i] = (uint8_t)((uint32_t)m_block.size() >> (i * 8));
+  }
+
+  fwrite(header, 1, sizeof(header), m_file);
+  fwrite(m_block.data(), 1, m_block.size(), m_file);
+  m_bytesWritten += sizeof(header) + m_block.size();
+  m_block.clear();
+}
+
+void CaptureFileWriter::WriteVarint(uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    m_block.push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  m_block.push_back((uint8_t)value);
+}
+
+void CaptureFileWriter::WriteTimeDelta(unsigned long long time)
+{
+  // Zigzag encoded, so out of order timestamps still work
+  int64_t delta = (int64_t)(time - m_lastTime);
+  WriteVarint(((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+  m_lastTime = time;
+}
+
+void CaptureFileWriter::WriteU32(uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+    m_block.push_back((uint8_t)(value >> (i * 8)));
+}
+
+void CaptureFileWriter::WriteU64(uint64_t value)
+{
+  for (int i = 0; i < 8; i++)
+    m_block.push_back((uint8_t)(value >> (i * 8)));
+}
+
+void CaptureFileWriter::WriteBytes(const void* data, size_t size)
+{
+  const uint8_t* bytes = (const uint8_t*)data;
+  m_block.insert(m_block.end(), bytes, bytes + size);
+}
+
+//******************************************************
+//                Capture File Reader
+//******************************************************
+CaptureFileReader::CaptureFileReader()
+  : m_data(nullptr), m_size(0), m_offset(0), m_ticksPerSecond(0)
+#ifdef _WIN32
+  , m_fileHandle(INVALID_HANDLE_VALUE), m_mappingHandle(nullptr)
+#endif
+{
+}
+
+CaptureFileReader::~CaptureFileReader()
+{
+  Close();
+}
+
+bool CaptureFileReader::Open(const char* path)
+{
+  Close();
+
+#ifdef _WIN32
+  m_fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (m_fileHandle == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(m_fileHandle, &size) || size.QuadPart == 0)
+  {
+    Close();
+    return false;
+  }
+
+  m_mappingHandle = CreateFileMappingA(m_fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (m_mappingHandle == nullptr)
+  {
+    Close();
+    return false;
+  }
+
+  m_data = (const uint8_t*)MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+  m_size = (size_t)size.QuadPart;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  // The mapping stays valid after closing the descriptor
+  void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+
+  m_data = (const uint8_t*)data;
+  m_size = (size_t)st.st_size;
+#endif
+
+  if (m_data == nullptr)
+  {
+    Close();
+    return false;
+  }
+
+  // Check the header, it's read through a block covering the start of the file
+  Block header = { 0, m_data, m_data + m_size, 0 };
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  uint64_t ticksPerSecond = 0;
+  if (!ReadU32(header, magic) || !ReadU32(header, version) || !ReadU64(header, ticksPerSecond) ||
+    magic != kMagic || version != kVersion || ticksPerSecond == 0)
+  {
+    Close();
+    return false;
+  }
+
+  m_ticksPerSecond = ticksPerSecond;
+  m_offset = header.current - m_data;
+  return true;
+}
+
+void CaptureFileReader::Close()
+{
+#ifdef _WIN32
+  if (m_data != nullptr)
+    UnmapViewOfFile(m_data);
+  if (m_mappingHandle != nullptr)
+    CloseHandle(m_mappingHandle);
+  if (m_fileHandle != INVALID_HANDLE_VALUE)
+    CloseHandle(m_fileHandle);
+  m_mappingHandle = nullptr;
+  m_fileHandle = INVALID_HANDLE_VALUE;
+#else
+  if (m_data != nullptr)
+    munmap((void*)m_data, m_size);
+#endif
+
+  m_data = nullptr;
+  m_size = 0;
+  m_offset = 0;
+  m_ticksPerSecond = 0;
+}
+
+bool CaptureFileReader::NextBlock(Block& block)
+{
+  Block header = { 0, m_data + m_offset, m_data + m_size, 0 };
+  uint32_t type = 0;
+  uint32_t size = 0;
+  if (!ReadU32(header, type) || !ReadU32(header, size) || size > (size_t)(header.end - header.current))
+    return false;
+
+  block.type = type;
+  block.current = header.current;
+  block.end = header.current + size;
+  block.lastTime = 0;
+
+  m_offset = block.end - m_data;
+  return true;
+}
+
+bool CaptureFileReader::ReadName(Block& block, uint32_t& id, uint32_t& color, std::string& name)
+{
+  uint64_t nameID = 0;
+  uint64_t length = 0;
+  if (!ReadVarint(block, nameID) || nameID > 0xFFFFFFFF || !ReadU32(block, color) || !ReadVarint(block, length) || length > (uint64_t)(block.end - block.current))
+    return false;
+
+  id = (uint32_t)nameID;
+  name.assign((const char*)block.current, (size_t)length);
+  block.current += length;
+  return true;
+}
+
+bool CaptureFileReader::ReadThread(Block& block, uint32_t& threadIndex, uint32_t& threadID, std::string& name)
+{
+  uint64_t index = 0;
+  uint64_t id = 0;
+  uint64_t length = 0;
+  if (!ReadVarint(block, index) || !ReadVarint(block, id) || !ReadVarint(block, length) || length > (uint64_t)(block.end - block.current))
+    return false;
+
+  threadIndex = (uint32_t)index;
+  threadID = (uint32_t)id;
+  name.assign((const char*)block.current, (size_t)length);
+  block.current += length;
+  return true;
+}
+
+bool CaptureFileReader::ReadEventThread(Block& block, uint32_t& threadIndex)
+{
+  uint64_t index = 0;
+  if (!ReadVarint(block, index))
+    return false;
+
+  threadIndex = (uint32_t)index;
+  return true;
+}
+
+bool CaptureFileReader::ReadEvent(Block& block, unsigned long long& startTime, unsigned long long& duration, uint32_t& nameID, uint32_t& depth)
+{
+  uint64_t eventDuration = 0;
+  uint64_t eventNameID = 0;
+  uint64_t eventDepth = 0;
+  if (!ReadTimeDelta(block, startTime) || !ReadVarint(block, eventDuration) || !ReadVarint(block, eventNameID) || !ReadVarint(block, eventDepth))
+    return false;
+
+  duration = eventDuration;
+  nameID = (uint32_t)eventNameID;
+  depth = (uint32_t)eventDepth;
+  return true;
+}
+
+bool CaptureFileReader::ReadToken(Block& block, unsigned long long& timestamp, uint32_t& nameID, uint32_t& depth, bool& isEnd)
+{
+  uint64_t value = 0, tokenNameID = 0;
+  if (!ReadTimeDelta(block, timestamp) || !ReadVarint(block, value))
+    return false;
+
+  isEnd = (value & 1) != 0;
+  if (!isEnd && !ReadVarint(block, tokenNameID))
+    return false;
+
+  depth = (uint32_t)(value >> 1);
+  nameID = (uint32_t)tokenNameID;
+  return true;
+}
+
+bool CaptureFileReader::ReadFrame(Block& block, unsigned long long& startTime, unsigned long long& duration, uint32_t& color)
+{
+  uint64_t frameDuration = 0;
+  if (!ReadTimeDelta(block, startTime) || !ReadVarint(block, frameDuration) || !ReadU32(block, color))
+    return false;
+
+  duration = frameDuration;
+  return true;
+}
+
+bool CaptureFileReader::ReadCaptureTime(Block& block, unsigned long long& captureTime)
+{
+  uint64_t time = 0;
+  if (!ReadU64(block, time))
+    return false;
+
+  captureTime = time;
+  return true;
+}
+
+bool CaptureFileReader::ReadVarint(Block& block, uint64_t& value)
+{
+  value = 0;
+  for (uint32_t shift = 0; shift < 64 && block.current < block.end; shift += 7)
+  {
+    uint8_t byte = *block.current++;
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+bool CaptureFileReader::ReadTimeDelta(Block& block, unsigned long long& time)
+{
+  uint64_t zigzag = 0;
+  if (!ReadVarint(block, zigzag))
+    return false;
+
+  int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+  block.lastTime += delta;
+  time = block.lastTime;
+  return true;
+}
+
+bool CaptureFileReader::ReadU32(Block& block, uint32_t& value)
+{
+  if (block.end - block.current < 4)
+    return false;
+
+  value = 0;
+  for (int i = 0; i < 4; i++)
+    value |= (uint32_t)block.current[i] << (i * 8);
+  block.current += 4;
+  return true;
+}
+
+bool CaptureFileReader::ReadU64(Block& block, uint64_t& value)
+{
+  if (block.end - block.current < 8)
+    return false;
+
+  value = 0;
+  for (int i = 0; i < 8; i++)
+    value |= (uint64_t)block.current[i] << (i * 8);
+  block.current += 8;
+  return true;
+}
@@ -0,0 +1,133 @@
+#ifndef _CAPTURE_FILE_H
+#define _CAPTURE_FILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+* Binary capture file layout, all values little endian:
+*   header: magic (u32), version (u32), timer ticks per second (u64)
+*   blocks: type (u32) and payload size (u32), followed by the payload
+* Blocks can come in any order and repeat, so files can be written while recording.
+* Most values are LEB128 varints, timestamps are stored as deltas to the previous one in the block
+*/
+namespace CaptureFile
+{
+  static const uint32_t kMagic = 0x46435250; // "PRCF"
+  static const uint32_t kVersion = 2; // 2: tokens carry their depth
+
+  enum BlockType : uint32_t
+  {
+    kBlockNames = 0,    // (id, color, name) for each name, ids are the ones used by the events in this file
+    kBlockThread,       // thread index, thread id and name. Thread ids can be reused, so blocks refer to threads by index
+    kBlockEvents,       // thread index, then (start delta, duration, name id, depth) for each event in start order
+    kBlockFrames,       // (start delta, duration, color) for each frame
+    kBlockCaptureTime,  // time the capture was taken
+    kBlockTokens,       // thread index, then (time delta, depth << 1 | is end, name id for begin tokens) for each token in record order
+  };
+}
+
+// Writes a capture file block by block, blocks are flushed to disk as soon as they're complete
+class CaptureFileWriter
+{
+public:
+  static const uint32_t kMaxBlockSize = 1 << 20; // large event and frame lists get split into multiple blocks
+
+  CaptureFileWriter();
+  ~CaptureFileWriter();
+
+  bool Open(const char* path);
+  bool Close(); // returns false if any write failed
+  bool IsOpen() { return m_file != nullptr; }
+  unsigned long long GetBytesWritten() { return m_bytesWritten; }
+
+  // Writes the names registered since the last call, so each name only ends up in the file once
+  void WriteNewNames();
+  void WriteThread(uint32_t threadIndex, uint32_t threadID, const char* name);
+  void WriteCaptureTime(unsigned long long captureTime);
+
+  void BeginEvents(uint32_t threadIndex);
+  void WriteEvent(unsigned long long startTime, unsigned long long duration, uint32_t nameID, uint32_t depth);
+  void EndEvents() { EndBlock(); }
+
+  void BeginTokens(uint32_t threadIndex);
+  void WriteToken(unsigned long long timestamp, uint32_t nameID, uint32_t depth, bool isEnd);
+  void EndTokens() { EndBlock(); }
+
+  void BeginFrames();
+  void WriteFrame(unsigned long long startTime, unsigned long long duration, uint32_t color);
+  void EndFrames() { EndBlock(); }
+
+private:
+  void BeginBlock(CaptureFile::BlockType type);
+  void EndBlock();
+
+  void WriteVarint(uint64_t value);
+  void WriteTimeDelta(unsigned long long time);
+  void WriteU32(uint32_t value);
+  void WriteU64(uint64_t value);
+  void WriteBytes(const void* data, size_t size);
+
+  FILE* m_file;
+  std::vector<uint8_t> m_block; // payload of the block being written
+  CaptureFile::BlockType m_blockType;
+  uint32_t m_blockThreadIndex;
+  unsigned long long m_lastTime; // delta base, reset with every block
+  uint32_t m_numNamesWritten;
+  unsigned long long m_bytesWritten;
+};
+
+// Maps a capture file into memory and decodes its blocks
+class CaptureFileReader
+{
+public:
+  // Read position inside a block
+  struct Block
+  {
+    uint32_t type;
+    const uint8_t* current;
+    const uint8_t* end;
+    unsigned long long lastTime;
+  };
+
+  CaptureFileReader();
+  ~CaptureFileReader();
+
+  bool Open(const char* path);
+  void Close();
+  bool IsOpen() { return m_data != nullptr; }
+
+  unsigned long long GetTicksPerSecond() { return m_ticksPerSecond; }
+
+  // Returns false once the end of the file, or a truncated block, is reached
+  bool NextBlock(Block& block);
+
+  // Block readers, these return false once the block is exhausted or corrupt
+  static bool ReadName(Block& block, uint32_t& id, uint32_t& color, std::string& name);
+  static bool ReadThread(Block& block, uint32_t& threadIndex, uint32_t& threadID, std::string& name);
+  static bool ReadEventThread(Block& block, uint32_t& threadIndex); // start of event and token blocks
+  static bool ReadEvent(Block& block, unsigned long long& startTime, unsigned long long& duration, uint32_t& nameID, uint32_t& depth);
+  static bool ReadToken(Block& block, unsigned long long& timestamp, uint32_t& nameID, uint32_t& depth, bool& isEnd); // nameID is only set for begin tokens
+  static bool ReadFrame(Block& block, unsigned long long& startTime, unsigned long long& duration, uint32_t& color);
+  static bool ReadCaptureTime(Block& block, unsigned long long& captureTime);
+
+private:
+  static bool ReadVarint(Block& block, uint64_t& value);
+  static bool ReadTimeDelta(Block& block, unsigned long long& time);
+  static bool ReadU32(Block& block, uint32_t& value);
+  static bool ReadU64(Block& block, uint64_t& value);
+
+  const uint8_t* m_data;
+  size_t m_size;
+  size_t m_offset;
+  unsigned long long m_ticksPerSecond;
+
+#ifdef _WIN32
+  void* m_fileHandle;
+  void* m_mappingHandle;
+#endif
+};
+
+#endif
@@ -1,6 +1,6 @@
 #ifndef _IMGUI_EXTENDED_H
 #define _IMGUI_EXTENDED_H
-#include "imgui\imgui.h"
+#include "imgui/imgui.h"
 
 // This class contains some extra clipping / rendering functions for imgui
 
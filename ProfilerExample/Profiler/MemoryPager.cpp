@@ -2,71 +2,139 @@
 
 MemoryPager MemoryPager::s_memoryPager;
 
-MemoryPager::MemoryPager() : m_numPages(0)
+// Small per-thread stash of free pages, so most GetPage / ReleasePage calls don't touch shared state
+struct MemoryPager::ThreadCache
 {
+  ThreadCache() : numPages(0) {}
+
+  // Hand cached pages back when the thread exits
+  ~ThreadCache()
+  {
+    while (numPages > 0)
+      MemoryPager::Get()->PushFreePage(pages[--numPages]);
+  }
+
+  Page* pages[kThreadCacheSize];
+  uint32_t numPages;
+};
+
+thread_local MemoryPager::ThreadCache MemoryPager::s_threadCache;
+
+MemoryPager::MemoryPager() : m_freeHead(kInvalidPageIndex), m_pageTableSize(0), m_numPages(0)
+{
+  for (uint32_t i = 0; i < kMaxPageTableChunks; i++)
+    m_pageTable[i].store(nullptr, std::memory_order_relaxed);
 }
 
 MemoryPager::~MemoryPager()
 {
-  for (auto it = m_freeList.begin(); it != m_freeList.end(); it)
-  {
-		Page* page = *it;
-		delete[] page->bufferStart;
-		delete page;
-    it = m_freeList.erase(it);
-  }
+  // Every page is in the page table, whether it's free or in use
+  uint32_t tableSize = m_pageTableSize.load(std::memory_order_acquire);
+  for (uint32_t i = 0; i < tableSize; i++)
+    FreePage(GetPageFromTable(i));
 
-  for (auto it = m_usedList.begin(); it != m_usedList.end(); it)
-  {
-		Page* page = *it;
-		delete[] page->bufferStart;
-		delete page;
-		it = m_usedList.erase(it);
-  }
+  for (uint32_t i = 0; i < kMaxPageTableChunks; i++)
+    delete[] m_pageTable[i].load(std::memory_order_relaxed);
 }
 
 MemoryPager::Page* MemoryPager::GetPage()
 {
   Page* p = nullptr;
-  if (m_freeList.size() > 0)
-  {
-    p = m_freeList.back();
-    m_freeList.pop_back();
-  }
+  if (s_threadCache.numPages > 0)
+    p = s_threadCache.pages[--s_threadCache.numPages];
   else
-  {
+    p = PopFreePage();
+
+  if (p == nullptr)
     p = AllocatePage();
-  }
 
-  m_usedList.push_back(p);
+  p->refCount.store(1, std::memory_order_relaxed);
   return p;
 }
 
+void MemoryPager::RetainPage(Page* page)
+{
+  page->refCount.fetch_add(1, std::memory_order_relaxed);
+}
+
 void MemoryPager::ReleasePage(Page* page)
 {
-  for (auto it = m_usedList.begin(); it != m_usedList.end(); it++)
-  {
-    if (*it == page)
-    {
-      page->bufferCurrent = page->bufferStart;
-      page->bufferReadOffset = page->bufferWriteOffset = 0;
+  // Last reference makes sure all other users are done with the page before it gets reused
+  if (page->refCount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    return;
+
+  page->bufferCurrent = page->bufferStart;
+  page->bufferReadOffset = 0;
+  page->bufferStreamOffset = 0;
+  page->bufferWriteOffset.store(0, std::memory_order_relaxed);
+
+  if (s_threadCache.numPages < kThreadCacheSize)
+    s_threadCache.pages[s_threadCache.numPages++] = page;
+  else
+    PushFreePage(page);
+}
 
-      m_usedList.erase(it);
-      m_freeList.push_back(page);
+MemoryPager::Page* MemoryPager::PopFreePage()
+{
+  uint64_t head = m_freeHead.load(std::memory_order_acquire);
+  while (true)
+  {
+    uint32_t index = (uint32_t)head;
+    if (index == kInvalidPageIndex)
+      return nullptr;
 
-			return;
-    }
+    // nextFree may be stale if another thread popped this page in the meantime, the tag makes the CAS fail in that case
+    Page* p = GetPageFromTable(index);
+    uint64_t newHead = (((head >> 32) + 1) << 32) | p->nextFree.load(std::memory_order_relaxed);
+    if (m_freeHead.compare_exchange_weak(head, newHead, std::memory_order_acquire, std::memory_order_acquire))
+      return p;
   }
 }
 
+void MemoryPager::PushFreePage(Page* page)
+{
+  uint64_t head = m_freeHead.load(std::memory_order_relaxed);
+  uint64_t newHead;
+  do
+  {
+    page->nextFree.store((uint32_t)head, std::memory_order_relaxed);
+    newHead = (((head >> 32) + 1) << 32) | page->index;
+  } while (!m_freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed));
+}
+
+MemoryPager::Page* MemoryPager::GetPageFromTable(uint32_t index)
+{
+  Page** chunk = m_pageTable[index / kPageTableChunkSize].load(std::memory_order_acquire);
+  return chunk[index % kPageTableChunkSize];
+}
+
 MemoryPager::Page* MemoryPager::AllocatePage()
 {
   Page* p = new Page();
   p->bufferStart = new int8_t[kPageSize];
   p->bufferCurrent = p->bufferStart;
-  p->bufferWriteOffset = p->bufferReadOffset = 0;
+  p->bufferReadOffset = 0;
+  p->bufferStreamOffset = 0;
+  p->bufferWriteOffset.store(0, std::memory_order_relaxed);
+  p->nextFree.store(kInvalidPageIndex, std::memory_order_relaxed);
+  p->listPrev = nullptr;
+  p->listNext.store(nullptr, std::memory_order_relaxed);
+
+  // Reserve a slot in the page table, allocating a new chunk if we're the first one to use it
+  p->index = m_pageTableSize.fetch_add(1, std::memory_order_relaxed);
+  std::atomic<Page**> &chunkSlot = m_pageTable[p->index / kPageTableChunkSize];
+  Page** chunk = chunkSlot.load(std::memory_order_acquire);
+  if (chunk == nullptr)
+  {
+    Page** newChunk = new Page*[kPageTableChunkSize]();
+    if (chunkSlot.compare_exchange_strong(chunk, newChunk, std::memory_order_acq_rel, std::memory_order_acquire))
+      chunk = newChunk;
+    else
+      delete[] newChunk;
+  }
+  chunk[p->index % kPageTableChunkSize] = p;
 
-  m_numPages++;
+  m_numPages.fetch_add(1, std::memory_order_relaxed);
   return p;
 }
 
@@ -76,3 +144,38 @@ void MemoryPager::FreePage(Page* page)
   delete page;
   m_numPages--;
 }
+
+//******************************************************
+//                Page List
+//******************************************************
+void MemoryPager::PageList::PushBack(Page* page)
+{
+  page->listPrev = m_tail;
+  page->listNext.store(nullptr, std::memory_order_relaxed);
+
+  // Publish the page, readers see it fully initialized
+  if (m_tail != nullptr)
+    m_tail->listNext.store(page, std::memory_order_release);
+  else
+    m_head.store(page, std::memory_order_release);
+
+  m_tail = page;
+}
+
+void MemoryPager::PageList::Remove(Page* page)
+{
+  Page* next = page->listNext.load(std::memory_order_acquire);
+
+  if (page->listPrev != nullptr)
+    page->listPrev->listNext.store(next, std::memory_order_release);
+  else
+    m_head.store(next, std::memory_order_release);
+
+  if (next != nullptr)
+    next->listPrev = page->listPrev;
+  else
+    m_tail = page->listPrev;
+
+  page->listPrev = nullptr;
+  page->listNext.store(nullptr, std::memory_order_relaxed);
+}
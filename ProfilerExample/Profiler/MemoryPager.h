@@ -1,41 +1,93 @@
 #ifndef _MEMORY_PAGER_H
 #define _MEMORY_PAGER_H
 
+#include <stdint.h>
+#include <atomic>
 #include <vector>
 
+// Thread-safe page allocator, pages are recycled through a lock-free free list
 class MemoryPager
 {
 public:
   
   static const uint32_t kPageSize = (uint32_t)256e3; 
+  static const uint32_t kPageTableChunkSize = 1024;
+  static const uint32_t kMaxPageTableChunks = 1024;
+  static const uint32_t kThreadCacheSize = 4; // pages kept per thread before going to the shared free list
+  static const uint32_t kInvalidPageIndex = 0xFFFFFFFF;
+
   struct Page
   {
     int8_t* bufferStart;
-    int8_t* bufferCurrent;
+    int8_t* bufferCurrent;  // scratch pointer for the writing thread
+
+    std::atomic<uint32_t> bufferWriteOffset; // offset from the start to write to, stored with release once a record is complete
+    uint32_t bufferReadOffset;               // offset from the start to begin reading from, only used by the reading thread
+    uint32_t bufferStreamOffset;             // records before this were handed to the stream writer, only used by the reading thread
+
+    uint32_t index;                   // index into the page table, never changes
+    std::atomic<uint32_t> nextFree;   // index of the next page in the free list
+    std::atomic<uint32_t> refCount;   // the page goes back to the free list when this reaches 0
+
+    // Intrusive hooks for the PageList the page is currently in
+    Page* listPrev;
+    std::atomic<Page*> listNext;
+  };
+
+  /*
+  * Intrusive doubly linked list of pages, so pages can be removed from the middle in O(1)
+  * One thread may append pages while another one iterates and removes them, as long as
+  * the last page is only removed once nothing gets appended anymore
+  */
+  class PageList
+  {
+  public:
+    PageList() : m_head(nullptr), m_tail(nullptr) {}
+
+    Page* Front() { return m_head.load(std::memory_order_acquire); }
+    static Page* Next(Page* page) { return page->listNext.load(std::memory_order_acquire); }
+    static bool IsLast(Page* page) { return Next(page) == nullptr; }
+    bool Empty() { return Front() == nullptr; }
+
+    void PushBack(Page* page);
+    void Remove(Page* page);
 
-    uint32_t bufferWriteOffset; // offset from the start to write to
-    uint32_t bufferReadOffset;  // offset from the start to begin reading from
+  private:
+    std::atomic<Page*> m_head;
+    Page* m_tail; // only used by the appending thread
   };
 
   static MemoryPager* Get() { return &s_memoryPager; }
 
+  // Pages start out with a single reference, RetainPage adds one so the page can be shared (e.g. by a capture)
   Page* GetPage();
+  void RetainPage(Page* page);
   void ReleasePage(Page* page);
 
-  uint32_t GetNumPages() { return m_numPages; }
+  uint32_t GetNumPages() { return m_numPages.load(std::memory_order_relaxed); }
 
 private:
+  struct ThreadCache;
+
   MemoryPager();
   ~MemoryPager();
 
   Page* AllocatePage();
   void FreePage(Page* page);
 
+  // Treiber stack, the head packs an ABA tag in the upper and a page index in the lower 32 bits
+  Page* PopFreePage();
+  void PushFreePage(Page* page);
+
+  Page* GetPageFromTable(uint32_t index);
+
   static MemoryPager s_memoryPager;
+  static thread_local ThreadCache s_threadCache;
 
-  std::vector<Page*> m_freeList;
-  std::vector<Page*> m_usedList;
-  uint32_t m_numPages;
+  std::atomic<uint64_t> m_freeHead;
+  std::atomic<Page**> m_pageTable[kMaxPageTableChunks]; // chunked, so it never has to be reallocated
+  std::atomic<uint32_t> m_pageTableSize;
+  std::atomic<uint32_t> m_numPages;
 };
 
-#endif
\ No newline at end of file
+#endif
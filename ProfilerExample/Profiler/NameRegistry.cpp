@@ -0,0 +1,74 @@
+#include <string.h>
+#include "NameRegistry.h"
+
+static uint32_t StringToColor(const char* str)
+{
+  int a = 54059;
+  int b = 76963;
+
+  int hash = 31;
+  size_t strl = strlen(str);
+
+  for (size_t i = 0; i < strl; i++)
+  {
+    hash = (hash * a) ^ (str[i] * b);
+    a = a * b;
+  }
+
+  uint8_t red = (uint8_t)((hash & 0xFF000000) >> 24);
+  uint8_t green = (uint8_t)((hash & 0x00FF0000) >> 16);
+  uint8_t blue = (uint8_t)((hash & 0x0000FF00) >> 8);
+
+  return NameRegistry::MakeColor(red, green, blue);
+}
+
+NameRegistry NameRegistry::s_nameRegistry;
+
+NameRegistry::NameRegistry() : m_numNames(0)
+{
+  memset(m_chunks, 0, sizeof(m_chunks));
+
+  // ID 0 is used for invalid / overflowing names
+  Register("Unknown event", 0);
+}
+
+NameRegistry::~NameRegistry()
+{
+  for (uint32_t i = 0; i < kMaxChunks; i++)
+    delete[] m_chunks[i];
+}
+
+uint32_t NameRegistry::Register(const char* name, uint32_t color)
+{
+  // Copy name, truncated to the size we can store
+  Entry entry;
+  size_t len = strlen(name);
+  memset(entry.name, 0, sizeof(entry.name));
+  memcpy(entry.name, name, len > sizeof(entry.name) - 1 ? sizeof(entry.name) - 1 : len);
+
+  // get color based on name if no color is set
+  entry.color = color != 0 ? color : StringToColor(entry.name);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  // Keyed on the final color, so names registered with their generated color (e.g. from a capture file) don't get duplicated
+  auto key = std::make_pair(std::string(entry.name), entry.color);
+  auto it = m_lookup.find(key);
+  if (it != m_lookup.end())
+    return it->second;
+
+  if (m_numNames >= kChunkSize * kMaxChunks)
+    return kInvalidNameID;
+
+  // Allocate a new chunk if needed
+  uint32_t id = m_numNames.load(std::memory_order_relaxed);
+  Entry*& chunk = m_chunks[id / kChunkSize];
+  if (chunk == nullptr)
+    chunk = new Entry[kChunkSize];
+
+  chunk[id % kChunkSize] = entry;
+  m_lookup[key] = id;
+  m_numNames.store(id + 1, std::memory_order_release);
+
+  return id;
+}
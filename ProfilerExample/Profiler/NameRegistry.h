@@ -0,0 +1,56 @@
+#ifndef _NAME_REGISTRY_H
+#define _NAME_REGISTRY_H
+
+#include <stdint.h>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <string>
+
+// Interns event names, so events only have to store a 32-bit name ID
+class NameRegistry
+{
+public:
+  static const uint32_t kChunkSize = 1024;
+  static const uint32_t kMaxChunks = 256; // 262144 unique names
+  static const uint32_t kInvalidNameID = 0;
+
+  struct Entry
+  {
+    char name[64];
+    uint32_t color;
+  };
+
+  static NameRegistry* Get() { return &s_nameRegistry; }
+
+  // Packs a color the way ImGui's IM_COL32 does, so the core doesn't depend on ImGui
+  static uint32_t MakeColor(uint32_t r, uint32_t g, uint32_t b, uint32_t a = 255) { return (a << 24) | (b << 16) | (g << 8) | r; }
+
+  /*
+  * Returns the ID for a name / color pair, registering it if it doesn't exist yet
+  * Takes a lock, so this should be called once per call site (see SCOPED_EVENT)
+  * A color of 0 generates a color based on the name
+  */
+  uint32_t Register(const char* name, uint32_t color);
+
+  const char* GetName(uint32_t id) { return GetEntry(id).name; }
+  uint32_t GetColor(uint32_t id) { return GetEntry(id).color; }
+  uint32_t GetNumNames() { return m_numNames.load(std::memory_order_acquire); } // names below this can be read without locking
+
+private:
+  NameRegistry();
+  ~NameRegistry();
+
+  // Entries live in fixed size chunks, so lookups never see a reallocation
+  const Entry& GetEntry(uint32_t id) { return m_chunks[id / kChunkSize][id % kChunkSize]; }
+
+  static NameRegistry s_nameRegistry;
+
+  Entry* m_chunks[kMaxChunks];
+  std::atomic<uint32_t> m_numNames;
+
+  std::map<std::pair<std::string, uint32_t>, uint32_t> m_lookup;
+  std::mutex m_mutex;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include <atomic>
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#define PERF_COUNTERS_SUPPORTED 1
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#else
+#define PERF_COUNTERS_SUPPORTED 0
+#endif
+
+#if PERF_COUNTERS_SUPPORTED
+// Reads a counter through its mmap page without a syscall, fails if the kernel doesn't allow rdpmc
+// or the counter isn't on the PMU right now
+static bool ReadCounterPage(void* mapping, unsigned long long& value)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  volatile perf_event_mmap_page* page = reinterpret_cast<volatile perf_event_mmap_page*>(mapping);
+  if (page == nullptr)
+    return false;
+
+  // The kernel bumps lock while it updates the page, e.g. when the thread got rescheduled
+  uint32_t seq;
+  do
+  {
+    seq = page->lock;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+
+    uint32_t index = page->index;
+    if (!page->cap_user_rdpmc || index == 0)
+      return false;
+
+    // The hardware counter is pmc_width bits wide and has to be sign extended
+    uint32_t shift = 64 - page->pmc_width;
+    long long count = (long long)((unsigned long long)__rdpmc(index - 1) << shift) >> shift;
+    value = (unsigned long long)(page->offset + count);
+
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+  } while (page->lock != seq);
+  return true;
+#else
+  (void)mapping;
+  (void)value;
+  return false;
+#endif
+}
+#endif
+
+const char* PerfCounters::GetName(uint32_t counter)
+{
+  static const char* names[kNumCounters] = { "cycles", "instructions", "LLC misses", "branch misses" };
+  return counter < kNumCounters ? names[counter] : "";
+}
+
+PerfCounters::PerfCounters()
+{
+  for (uint32_t i = 0; i < kNumCounters; i++)
+  {
+    m_fds[i] = -1;
+    m_pages[i] = nullptr;
+  }
+}
+
+bool PerfCounters::Open()
+{
+#if PERF_COUNTERS_SUPPORTED
+  if (IsOpen())
+    return true;
+
+  static const unsigned long long configs[kNumCounters] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+  long pageSize = sysconf(_SC_PAGESIZE);
+
+  for (uint32_t i = 0; i < kNumCounters; i++)
+  {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[i];
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1; // also what perf_event_paranoid 2 allows
+    attr.exclude_hv = 1;
+
+    m_fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : m_fds[0], 0);
+    if (m_fds[i] < 0)
+    {
+      Close();
+      return false;
+    }
+
+    void* mapping = mmap(nullptr, (size_t)pageSize, PROT_READ, MAP_SHARED, m_fds[i], 0);
+    m_pages[i] = mapping != MAP_FAILED ? mapping : nullptr;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void PerfCounters::Close()
+{
+#if PERF_COUNTERS_SUPPORTED
+  long pageSize = sysconf(_SC_PAGESIZE);
+
+  // Members go before the group leader
+  for (uint32_t i = kNumCounters; i-- > 0;)
+  {
+    if (m_pages[i] != nullptr)
+      munmap(m_pages[i], (size_t)pageSize);
+    if (m_fds[i] >= 0)
+      close(m_fds[i]);
+    m_fds[i] = -1;
+    m_pages[i] = nullptr;
+  }
+#endif
+}
+
+void PerfCounters::Read(unsigned long long* values)
+{
+#if PERF_COUNTERS_SUPPORTED
+  uint32_t i = 0;
+  while (i < kNumCounters && ReadCounterPage(m_pages[i], values[i]))
+    i++;
+  if (i == kNumCounters)
+    return;
+
+  // One syscall reads the whole group, the layout is { nr, value[nr] }
+  unsigned long long group[1 + kNumCounters];
+  if (IsOpen() && read(m_fds[0], group, sizeof(group)) == (ssize_t)sizeof(group))
+  {
+    for (i = 0; i < kNumCounters; i++)
+      values[i] = group[1 + i];
+    return;
+  }
+#endif
+
+  for (uint32_t c = 0; c < kNumCounters; c++)
+    values[c] = 0;
+}
@@ -0,0 +1,42 @@
+#ifndef _PERF_COUNTERS_H
+#define _PERF_COUNTERS_H
+
+#include <stdint.h>
+
+/*
+* Hardware performance counters of one thread, Linux only (perf_event_open). Open fails elsewhere,
+* and on machines without a PMU (most VMs)
+* The counters are opened as one group so they count over the same time. Read uses rdpmc when the kernel
+* allows it, which avoids a syscall per read
+*/
+class PerfCounters
+{
+public:
+  enum Counter
+  {
+    kCycles = 0,
+    kInstructions,
+    kCacheMisses,   // last level cache
+    kBranchMisses,
+    kNumCounters
+  };
+
+  static const char* GetName(uint32_t counter);
+
+  PerfCounters();
+  ~PerfCounters() { Close(); }
+
+  // Counts user space only, for the calling thread
+  bool Open();
+  void Close();
+  bool IsOpen() { return m_fds[0] >= 0; }
+
+  // Current values, only valid on the thread that opened the counters
+  void Read(unsigned long long* values);
+
+private:
+  int m_fds[kNumCounters]; // the first one leads the group
+  void* m_pages[kNumCounters]; // perf_event_mmap_page per counter, null if rdpmc can't be used
+};
+
+#endif
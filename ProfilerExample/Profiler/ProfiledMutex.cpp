@@ -0,0 +1,181 @@
+#include "ProfiledMutex.h"
+#include "Profiler.h"
+#include "TimedEvent.h"
+#include "NameRegistry.h"
+#include "Timer.h"
+
+//******************************************************
+//                Lock Profiler
+//******************************************************
+LockProfiler::LockProfiler(const char* name)
+  : m_name(name), m_nameID(NameRegistry::kInvalidNameID), m_owner(0), m_waiters(0), m_acquireTime(0)
+{
+}
+
+uint32_t LockProfiler::GetNameID()
+{
+  // Registering is idempotent, racing threads get the same ID
+  uint32_t nameID = m_nameID.load(std::memory_order_relaxed);
+  if (nameID == NameRegistry::kInvalidNameID)
+  {
+    nameID = NameRegistry::Get()->Register(m_name, 0);
+    m_nameID.store(nameID, std::memory_order_relaxed);
+  }
+  return nameID;
+}
+
+unsigned long long LockProfiler::BeginWait(const void* lock, bool shared)
+{
+  if (!TimedEvent::IsCaptureEnabled())
+    return 0;
+
+  // Threads that are exiting have no manager anymore
+  ProfilerEventManager* mngr = Profiler::Get()->GetEventManager();
+  if (mngr == nullptr)
+    return 0;
+
+  // The owner can change before we block, it's the thread the wait most likely started on
+  unsigned long long waitStart = Timer::Now();
+  m_waiters.fetch_add(1, std::memory_order_relaxed);
+  mngr->AddLockRecord(ProfilerEventManager::kLockWait, lock, GetNameID(), waitStart, waitStart, m_owner.load(std::memory_order_relaxed), shared);
+  return waitStart;
+}
+
+void LockProfiler::EndWait(const void* lock, bool shared, unsigned long long waitStart)
+{
+  if (waitStart == 0)
+    return;
+
+  m_waiters.fetch_sub(1, std::memory_order_relaxed);
+  ProfilerEventManager* mngr = Profiler::Get()->GetEventManager();
+  if (mngr != nullptr)
+    mngr->AddLockRecord(ProfilerEventManager::kLockAcquired, lock, GetNameID(), waitStart, Timer::Now(), 0, shared);
+}
+
+void LockProfiler::Acquired(bool shared)
+{
+  // Readers don't own the lock, waiters on them show no holder
+  if (shared || !TimedEvent::IsCaptureEnabled())
+    return;
+
+  ProfilerEventManager* mngr = Profiler::Get()->GetEventManager();
+  if (mngr == nullptr)
+    return;
+
+  m_owner.store(mngr->GetThreadID(), std::memory_order_relaxed);
+  m_acquireTime = Timer::Now();
+}
+
+unsigned long long LockProfiler::BeginRelease(bool shared, unsigned long long& holdStart)
+{
+  bool contended = m_waiters.load(std::memory_order_relaxed) > 0;
+  unsigned long long releaseTime = contended ? Timer::Now() : 0;
+
+  // Reader holds aren't timed, they show up as a release marker
+  holdStart = shared ? releaseTime : m_acquireTime;
+  if (!shared)
+  {
+    m_owner.store(0, std::memory_order_relaxed);
+    m_acquireTime = 0;
+  }
+  return releaseTime;
+}
+
+void LockProfiler::EndRelease(const void* lock, bool shared, unsigned long long holdStart, unsigned long long releaseTime)
+{
+  if (releaseTime == 0 || holdStart == 0)
+    return;
+
+  ProfilerEventManager* mngr = Profiler::Get()->GetEventManager();
+  if (mngr != nullptr)
+    mngr->AddLockRecord(ProfilerEventManager::kLockReleased, lock, GetNameID(), holdStart, releaseTime, 0, shared);
+}
+
+//******************************************************
+//                Profiled Mutex
+//******************************************************
+void ProfiledMutex::lock()
+{
+  if (!m_mutex.try_lock())
+  {
+    unsigned long long waitStart = m_profiler.BeginWait(this, false);
+    m_mutex.lock();
+    m_profiler.Acquired(false);
+    m_profiler.EndWait(this, false, waitStart);
+    return;
+  }
+  m_profiler.Acquired(false);
+}
+
+bool ProfiledMutex::try_lock()
+{
+  if (!m_mutex.try_lock())
+    return false;
+
+  m_profiler.Acquired(false);
+  return true;
+}
+
+void ProfiledMutex::unlock()
+{
+  unsigned long long holdStart;
+  unsigned long long releaseTime = m_profiler.BeginRelease(false, holdStart);
+  m_mutex.unlock();
+  m_profiler.EndRelease(this, false, holdStart, releaseTime);
+}
+
+//******************************************************
+//                Profiled Shared Mutex
+//******************************************************
+void ProfiledSharedMutex::lock()
+{
+  if (!m_mutex.try_lock())
+  {
+    unsigned long long waitStart = m_profiler.BeginWait(this, false);
+    m_mutex.lock();
+    m_profiler.Acquired(false);
+    m_profiler.EndWait(this, false, waitStart);
+    return;
+  }
+  m_profiler.Acquired(false);
+}
+
+bool ProfiledSharedMutex::try_lock()
+{
+  if (!m_mutex.try_lock())
+    return false;
+
+  m_profiler.Acquired(false);
+  return true;
+}
+
+void ProfiledSharedMutex::unlock()
+{
+  unsigned long long holdStart;
+  unsigned long long releaseTime = m_profiler.BeginRelease(false, holdStart);
+  m_mutex.unlock();
+  m_profiler.EndRelease(this, false, holdStart, releaseTime);
+}
+
+void ProfiledSharedMutex::lock_shared()
+{
+  if (!m_mutex.try_lock_shared())
+  {
+    unsigned long long waitStart = m_profiler.BeginWait(this, true);
+    m_mutex.lock_shared();
+    m_profiler.EndWait(this, true, waitStart);
+  }
+}
+
+bool ProfiledSharedMutex::try_lock_shared()
+{
+  return m_mutex.try_lock_shared();
+}
+
+void ProfiledSharedMutex::unlock_shared()
+{
+  unsigned long long holdStart;
+  unsigned long long releaseTime = m_profiler.BeginRelease(true, holdStart);
+  m_mutex.unlock_shared();
+  m_profiler.EndRelease(this, true, holdStart, releaseTime);
+}
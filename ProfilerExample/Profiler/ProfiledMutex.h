@@ -0,0 +1,75 @@
+#ifndef _PROFILED_MUTEX_H
+#define _PROFILED_MUTEX_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+
+/*
+* Contention tracking shared by the mutex wrappers. Uncontended locks aren't recorded, a thread that has to
+* wait records when the wait started and when it got the lock, and the holder records its hold when it releases
+* the lock to a waiter. The timeline draws both and links the wait to the holder (see ProfilerEventManager::LockRecord)
+*/
+class LockProfiler
+{
+public:
+  // The name has to outlive the lock
+  LockProfiler(const char* name);
+
+  // Around blocking on the lock. BeginWait returns the wait start, or 0 while events aren't recorded
+  unsigned long long BeginWait(const void* lock, bool shared);
+  void EndWait(const void* lock, bool shared, unsigned long long waitStart);
+
+  void Acquired(bool shared);
+
+  // Around unlocking. BeginRelease returns the release time if a thread is waiting, 0 otherwise
+  unsigned long long BeginRelease(bool shared, unsigned long long& holdStart);
+  void EndRelease(const void* lock, bool shared, unsigned long long holdStart, unsigned long long releaseTime);
+
+private:
+  // Registered on first use, mutexes can be globals constructed before the name registry
+  uint32_t GetNameID();
+
+  const char* m_name;
+  std::atomic<uint32_t> m_nameID;
+  std::atomic<uint32_t> m_owner;      // thread ID of the exclusive holder, 0 while free or held shared
+  std::atomic<uint32_t> m_waiters;
+  unsigned long long m_acquireTime;   // of the exclusive holder, only used by it
+};
+
+// Drop-in std::mutex replacement that records lock contention
+class ProfiledMutex
+{
+public:
+  ProfiledMutex(const char* name = "Mutex") : m_profiler(name) {}
+
+  void lock();
+  bool try_lock();
+  void unlock();
+
+private:
+  std::mutex m_mutex;
+  LockProfiler m_profiler;
+};
+
+// Drop-in replacement for std::shared_timed_mutex, without the timed functions
+class ProfiledSharedMutex
+{
+public:
+  ProfiledSharedMutex(const char* name = "SharedMutex") : m_profiler(name) {}
+
+  void lock();
+  bool try_lock();
+  void unlock();
+
+  void lock_shared();
+  bool try_lock_shared();
+  void unlock_shared();
+
+private:
+  std::shared_timed_mutex m_mutex;
+  LockProfiler m_profiler;
+};
+
+#endif
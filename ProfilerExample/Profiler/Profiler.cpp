@@ -1,133 +1,249 @@
 ﻿#include <stdarg.h>
+#include <stdlib.h>
 #include <time.h>
 #include <string>
+#include <algorithm>
 #include <thread>
 #include "Profiler.h"
-#include "imgui/imgui.h"
-#include "ImGuiExtended.h"
 #include "Timer.h"
-
-uint32_t StringToColor(const char* str)
+#include "NameRegistry.h"
+#include "TimedEvent.h"
+#include "CaptureFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#else
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+// OS thread ID of the calling thread, matches what debuggers and other profilers show
+static uint32_t GetCurrentThreadID()
 {
-  int a = 54059;
-  int b = 76963;
+#ifdef _WIN32
+  return (uint32_t)GetCurrentThreadId();
+#elif defined(__APPLE__)
+  uint64_t tid = 0;
+  pthread_threadid_np(nullptr, &tid);
+  return (uint32_t)tid;
+#else
+  return (uint32_t)syscall(SYS_gettid);
+#endif
+}
 
-  int hash = 31;
-  size_t strl = strlen(str);
+//******************************************************
+//                Profiler Event Manager
+//******************************************************
+ProfilerEventManager::ProfilerEventManager(RecordFormat format)
+  : m_format(format), m_currentPage(nullptr), m_nextManager(nullptr), m_retired(false), m_streamIndex(kInvalidStreamIndex)
+  , m_currentSamplePage(nullptr), m_spareSamplePage(nullptr), m_droppedSamples(0), m_currentAllocPage(nullptr), m_allocCountdown(0)
+  , m_currentLockPage(nullptr)
+{
+  snprintf(m_threadName, sizeof(m_threadName), "test thread");
+  m_threadID = GetCurrentThreadID();
+  m_allocRandom = (m_threadID | 1ull) * 0x9E3779B97F4A7C15ull; // never 0
+  Sampler::InitThread(m_samplerState);
+
+  // Counters count the thread that opens them
+  if (m_format == kRecordCounters && !m_counters.Open())
+    m_format = kRecordEvents;
+}
 
-  for (size_t i = 0; i < strl; i++)
+ProfilerEventManager::~ProfilerEventManager()
+{
+  while (!m_pages.Empty())
   {
-    hash = (hash * a) ^ (str[i] * b);
-    a = a * b;
+    MemoryPager::Page* page = m_pages.Front();
+    m_pages.Remove(page);
+    MemoryPager::Get()->ReleasePage(page);
   }
 
-  uint8_t red = (uint8_t)((hash & 0xFF000000) >> 24);
-  uint8_t green = (uint8_t)((hash & 0x00FF0000) >> 16);
-  uint8_t blue = (uint8_t)((hash & 0x0000FF00) >> 8);
+  MemoryPager::PageList* pageLists[] = { &m_samplePages, &m_allocPages, &m_lockPages };
+  for (MemoryPager::PageList* pages : pageLists)
+  {
+    while (!pages->Empty())
+    {
+      MemoryPager::Page* page = pages->Front();
+      pages->Remove(page);
+      MemoryPager::Get()->ReleasePage(page);
+    }
+  }
 
-  return IM_COL32(red, green, blue, 255);
+  if (MemoryPager::Page* spare = m_spareSamplePage.load(std::memory_order_relaxed))
+    MemoryPager::Get()->ReleasePage(spare);
 }
 
-std::string BytesToSize(float bytes)
+int8_t* ProfilerEventManager::ReserveRecord(uint32_t size)
 {
-  static const float tb = 1099511627776;
-  static const float gb = 1073741824;
-  static const float mb = 1048576;
-  static const float kb = 1024;
-
-  char temp[1024] = {};
-
-  if (bytes >= tb)
-    sprintf_s(temp, "%.2f TB", (float)bytes * (1.0f / tb));
-  else if (bytes >= gb)
-    sprintf_s(temp, "%.2f GB", (float)bytes * (1.0f / gb));
-  else if (bytes >= mb)
-    sprintf_s(temp, "%.2f MB", (float)bytes * (1.0f / mb));
-  else if (bytes >= kb)
-    sprintf_s(temp, "%.2f KB", (float)bytes * (1.0f / kb));
-  else
-    sprintf_s(temp, "%.2f B", bytes);
+  // Check if record will fit in current page
+  if (m_currentPage == nullptr || m_currentPage->bufferWriteOffset.load(std::memory_order_relaxed) + size > MemoryPager::kPageSize)
+  {
+    m_currentPage = MemoryPager::Get()->GetPage();
+    m_pages.PushBack(m_currentPage);
+  }
 
-  std::string returnSize(temp);
-  return returnSize;
+  m_currentPage->bufferCurrent = m_currentPage->bufferStart + m_currentPage->bufferWriteOffset.load(std::memory_order_relaxed);
+  return m_currentPage->bufferCurrent;
 }
 
-//******************************************************
-//                Profiler Event Manager
-//******************************************************
-ProfilerEventManager::ProfilerEventManager()
-  : m_currentPage(nullptr), m_stackPage(nullptr)
-  , m_eventDepth(0)
+void ProfilerEventManager::CommitRecord(uint32_t size)
 {
-  strcpy_s(m_threadName, "test thread");
-  m_threadID = (uint32_t)__threadid();
+  // Release, so the frame thread never sees a partially written record
+  uint32_t writeOffset = m_currentPage->bufferWriteOffset.load(std::memory_order_relaxed);
+  m_currentPage->bufferWriteOffset.store(writeOffset + size, std::memory_order_release);
 }
 
-ProfilerEventManager::ProfilerEvent* ProfilerEventManager::PushEvent(uint32_t color, const char* pFormat)
+void ProfilerEventManager::PushEvent(uint32_t nameID)
 {
-  ProfilerEvent ev;
-
-  ev.depth = m_eventDepth++;
-  ev.color = color;
-
-  // Copy name
-  size_t len = strlen(pFormat);
-	memset(ev.name, 0, 64);
-  memcpy(ev.name, pFormat, len > 64 ? 64 : len);
-
-  // Check if event will fit in current page // TODO - free stack pages??
-  if (m_stackPage == nullptr)
-  {
-    m_stackPage = MemoryPager::Get()->GetPage();
-    m_stackPages.push_back(m_stackPage);
-  }
-  else if (m_stackPage->bufferWriteOffset + sizeof(ProfilerEvent) > MemoryPager::kPageSize)
+  if (m_format == kRecordStream)
   {
-    m_stackPage = MemoryPager::Get()->GetPage();
-    m_stackPages.push_back(m_stackPage);
+    StreamToken* token = reinterpret_cast<StreamToken*>(ReserveRecord(sizeof(StreamToken)));
+    token->nameID = nameID;
+    token->type = kTokenBegin;
+    token->depth = (uint32_t)m_nameStack.size();
+    token->timestamp = Timer::Now();
+    m_nameStack.push_back(nameID);
+    CommitRecord(sizeof(StreamToken));
+    return;
   }
 
-  // Copy the event into the memory page and add to event stack
-  m_stackPage->bufferCurrent = m_stackPage->bufferStart + m_stackPage->bufferWriteOffset;
-  memcpy(m_stackPage->bufferCurrent, &ev, sizeof(ProfilerEvent));
-  m_eventStack.push_back((ProfilerEvent*)m_stackPage->bufferCurrent);
+  // Reserve the event slot in the history page, the duration gets patched when the event ends
+  uint32_t recordSize = GetRecordSize();
+  ProfilerEvent* ev = reinterpret_cast<ProfilerEvent*>(ReserveRecord(recordSize));
+  ev->duration.store(kOpenEventDuration, std::memory_order_relaxed);
+  ev->nameID = nameID;
+  ev->depth = (uint32_t)m_eventStack.size();
+  m_eventStack.push_back(ev);
 
-  // Update page variables
-  m_stackPage->bufferWriteOffset += sizeof(ProfilerEvent);
+  if (m_format == kRecordCounters)
+    m_counters.Read(reinterpret_cast<CountedEvent*>(ev)->counters);
 
-	return (ProfilerEvent*)m_stackPage->bufferCurrent;
+  ev->startTime = Timer::Now();
+  CommitRecord(recordSize);
 }
 
 void ProfilerEventManager::PopEvent()
 {
+  unsigned long long endTime = Timer::NowSerialized();
+
+  if (m_format == kRecordStream)
+  {
+    StreamToken* token = reinterpret_cast<StreamToken*>(ReserveRecord(sizeof(StreamToken)));
+    m_nameStack.pop_back();
+    token->timestamp = endTime;
+    token->type = kTokenEnd;
+    token->depth = (uint32_t)m_nameStack.size();
+    CommitRecord(sizeof(StreamToken));
+    return;
+  }
+
+  // The event is already visible to the frame thread, so the duration is patched atomically
   ProfilerEvent* ev = m_eventStack.back();
   m_eventStack.pop_back();
 
-  if (ev->duration >= 1)
+  // Readers only look at the counters once the duration is set
+  if (m_format == kRecordCounters)
   {
-    // get color based on name if no color is set
-    if (ev->color == 0)
-      ev->color = StringToColor(ev->name);
+    unsigned long long endCounters[PerfCounters::kNumCounters];
+    m_counters.Read(endCounters);
+    CountedEvent* counted = reinterpret_cast<CountedEvent*>(ev);
+    for (uint32_t i = 0; i < PerfCounters::kNumCounters; i++)
+      counted->counters[i] = endCounters[i] - counted->counters[i];
+  }
 
-    // Check if event will fit in current page
-    if (m_currentPage == nullptr)
-    {
-      m_currentPage = MemoryPager::Get()->GetPage();
-      m_pages.push_back(m_currentPage);
-    }
-    else if (m_currentPage->bufferWriteOffset + sizeof(ProfilerEvent) > MemoryPager::kPageSize)
+  ev->duration.store(endTime - ev->startTime, std::memory_order_release);
+}
+
+void ProfilerEventManager::EndOpenEvents()
+{
+  while (!m_eventStack.empty() || !m_nameStack.empty())
+    PopEvent();
+}
+
+void ProfilerEventManager::AddSample(unsigned long long timestamp, const uint64_t* frames, uint32_t numFrames)
+{
+  MemoryPager::Page* page = m_currentSamplePage;
+  if (page == nullptr || page->bufferWriteOffset.load(std::memory_order_relaxed) + sizeof(Sample) > MemoryPager::kPageSize)
+  {
+    page = m_spareSamplePage.exchange(nullptr, std::memory_order_acquire);
+    if (page == nullptr)
     {
-      m_currentPage = MemoryPager::Get()->GetPage();
-      m_pages.push_back(m_currentPage);
+      m_droppedSamples.fetch_add(1, std::memory_order_relaxed);
+      return;
     }
+    m_samplePages.PushBack(page);
+    m_currentSamplePage = page;
+  }
 
-    // Copy the event into the current page
-    m_currentPage->bufferCurrent = m_currentPage->bufferStart + m_currentPage->bufferWriteOffset;
-    memcpy(m_currentPage->bufferCurrent, ev, sizeof(ProfilerEvent));
-    m_currentPage->bufferWriteOffset += sizeof(ProfilerEvent);
+  uint32_t writeOffset = page->bufferWriteOffset.load(std::memory_order_relaxed);
+  Sample* sample = reinterpret_cast<Sample*>(page->bufferStart + writeOffset);
+  sample->timestamp = timestamp;
+  sample->numFrames = numFrames < kMaxSampleFrames ? numFrames : kMaxSampleFrames;
+  sample->pad = 0;
+  for (uint32_t i = 0; i < sample->numFrames; i++)
+    sample->frames[i] = frames[i];
+  page->bufferWriteOffset.store(writeOffset + sizeof(Sample), std::memory_order_release);
+}
+
+void ProfilerEventManager::AddAllocation(AllocType type, uint64_t address, unsigned long long bytes, long long liveBytes)
+{
+  MemoryPager::Page* page = m_currentAllocPage;
+  if (page == nullptr || page->bufferWriteOffset.load(std::memory_order_relaxed) + sizeof(AllocRecord) > MemoryPager::kPageSize)
+  {
+    page = m_currentAllocPage = MemoryPager::Get()->GetPage();
+    m_allocPages.PushBack(page);
   }
 
-  m_eventDepth--;
+  uint32_t writeOffset = page->bufferWriteOffset.load(std::memory_order_relaxed);
+  AllocRecord* record = reinterpret_cast<AllocRecord*>(page->bufferStart + writeOffset);
+  record->timestamp = Timer::Now();
+  record->address = address;
+  record->bytes = bytes;
+  record->liveBytes = liveBytes;
+  if (m_format == kRecordStream)
+    record->nameID = m_nameStack.empty() ? NameRegistry::kInvalidNameID : m_nameStack.back();
+  else
+    record->nameID = m_eventStack.empty() ? NameRegistry::kInvalidNameID : m_eventStack.back()->nameID;
+  record->type = type;
+  page->bufferWriteOffset.store(writeOffset + sizeof(AllocRecord), std::memory_order_release);
+}
+
+void ProfilerEventManager::AddLockRecord(LockEventType type, const void* lock, uint32_t nameID, unsigned long long startTime, unsigned long long timestamp, uint32_t holderThreadID, bool shared)
+{
+  MemoryPager::Page* page = m_currentLockPage;
+  if (page == nullptr || page->bufferWriteOffset.load(std::memory_order_relaxed) + sizeof(LockRecord) > MemoryPager::kPageSize)
+  {
+    page = m_currentLockPage = MemoryPager::Get()->GetPage();
+    m_lockPages.PushBack(page);
+  }
+
+  uint32_t writeOffset = page->bufferWriteOffset.load(std::memory_order_relaxed);
+  LockRecord* record = reinterpret_cast<LockRecord*>(page->bufferStart + writeOffset);
+  record->timestamp = timestamp;
+  record->startTime = startTime;
+  record->lockID = (uint64_t)(uintptr_t)lock;
+  record->nameID = nameID;
+  record->type = type;
+  record->holderThreadID = holderThreadID;
+  record->shared = shared ? 1 : 0;
+  page->bufferWriteOffset.store(writeOffset + sizeof(LockRecord), std::memory_order_release);
+}
+
+bool ProfilerEventManager::IsRecordOutdated(const int8_t* record, unsigned long long cutoffTime)
+{
+  if (m_format == kRecordStream)
+    return reinterpret_cast<const StreamToken*>(record)->timestamp < cutoffTime;
+
+  const ProfilerEvent* ev = reinterpret_cast<const ProfilerEvent*>(record);
+  unsigned long long duration = ev->duration.load(std::memory_order_acquire);
+  if (duration == kOpenEventDuration)
+    return false; // still running
+
+  return ev->startTime + duration < cutoffTime;
 }
 
 //******************************************************
@@ -136,66 +252,174 @@ void ProfilerEventManager::PopEvent()
 Profiler Profiler::s_profiler;
 
 Profiler::Profiler()
-  : m_isOpen(true), m_numEventsInCapture(0), m_zoom(0)
-  , m_precedingFrameTime(10), m_procedingFrameTime(10), m_lastXAmountOfTime((int)(100))
-{}
+  : m_frameTimes(kMaxFrames), m_managers(nullptr), m_numManagers(0), m_recordFormat(ProfilerEventManager::kRecordEvents), m_isOpen(true)
+  , m_capture(new Capture()), m_finishedCapture(nullptr), m_captureProgress(0), m_captureProgressTotal(0), m_numStreamedThreads(0), m_samplingFrequency(Sampler::kDefaultFrequency), m_showScopeStats(false), m_statsSortColumn(3), m_statsSortDescending(true), m_showCallTree(false), m_callTreeAsFlameGraph(true), m_captureFileError(nullptr), m_shutdownRegistered(false)
+  , m_precedingFrameTime(10), m_procedingFrameTime(10), m_lastXAmountOfTime((int)(100)), m_framesPerSecond(0), m_zoom(0), m_frameStart(0), m_historyTime(kMaxProfileTime)
+{
+  snprintf(m_captureFilePath, sizeof(m_captureFilePath), "capture.prcf");
+}
 
 Profiler::~Profiler()
-{}
+{
+  // Pages aren't released here, the pager frees them all on shutdown. Background work was stopped by Shutdown,
+  // the pager and name registry may already be destroyed at this point
+  delete m_finishedCapture.load();
+}
 
-void Profiler::UpdateZoom()
+void Profiler::Shutdown()
 {
-	// TODO - update scroll position based on scroll amount
-	if (ImGui::GetIO().MouseWheel)
-	{
-		m_zoom += ImGui::GetIO().MouseWheel * 10.0f;
-		m_zoom = std::fmax(std::fmin(m_zoom, 1000.0f), 0.0f);
-	}
+  StopSampling();
+  StopStreaming();
+  if (m_captureThread.joinable())
+    m_captureThread.join();
+}
+
+void Profiler::RegisterShutdown()
+{
+  if (m_shutdownRegistered)
+    return;
+
+  atexit(&Profiler::ShutdownAtExit);
+  m_shutdownRegistered = true;
 }
 
 // Create a per-thread manager
 thread_local ProfilerEventManager* g_manager = nullptr;
+thread_local bool g_managerRetired = false; // trivially destructible, so it's still valid in other thread_local destructors
+
+// Retires the thread's manager when the thread exits. Destructors of other thread_locals may still record
+// events, allocations or lock waits afterwards, they see no manager instead of one that may already be deleted
+struct ManagerRetirer
+{
+  ~ManagerRetirer()
+  {
+    g_managerRetired = true;
+
+    // Unreachable before it's retired, a sample signal arriving in between still sees a live manager
+    ProfilerEventManager* retiring = g_manager;
+    g_manager = nullptr;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    if (retiring != nullptr)
+    {
+      // Their end can't reach the manager anymore, and an open event would keep its page from expiring
+      retiring->EndOpenEvents();
+      retiring->Retire();
+    }
+  }
+};
+
+thread_local ManagerRetirer g_managerRetirer;
 ProfilerEventManager* Profiler::GetEventManager()
 {
   if (g_manager == nullptr)
   {
-    g_manager = new ProfilerEventManager();
-    m_managers.push_back(g_manager);
+    if (g_managerRetired)
+      return nullptr;
+
+    // Constructs the retirer on first use, its destructor then runs when the thread exits
+    (void)g_managerRetirer;
+    g_manager = new ProfilerEventManager(m_recordFormat);
+
+    // Push it to the front of the manager list
+    ProfilerEventManager* head = m_managers.load(std::memory_order_relaxed);
+    do
+    {
+      g_manager->m_nextManager = head;
+    } while (!m_managers.compare_exchange_weak(head, g_manager, std::memory_order_release, std::memory_order_relaxed));
+    m_numManagers.fetch_add(1, std::memory_order_relaxed);
   }
 
   return g_manager;
 }
 
-ProfilerEventManager::ProfilerEvent* Profiler::BeginEvent(uint32_t color, const char* aName)
+ProfilerEventManager* Profiler::GetCurrentEventManager()
+{
+  return g_manager;
+}
+
+void Profiler::UnregisterManager(ProfilerEventManager* mngr, ProfilerEventManager* prev)
+{
+  ProfilerEventManager* next = mngr->m_nextManager;
+
+  if (prev == nullptr)
+  {
+    // Try to pop it from the front, if other threads pushed new managers in the meantime search for the one before it
+    prev = mngr;
+    if (!m_managers.compare_exchange_strong(prev, next, std::memory_order_acq_rel, std::memory_order_acquire))
+    {
+      while (prev->m_nextManager != mngr)
+        prev = prev->m_nextManager;
+      prev->m_nextManager = next;
+    }
+  }
+  else
+    prev->m_nextManager = next;
+
+  m_numManagers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void Profiler::SetHistoryTime(unsigned long long ns)
+{
+  if (ns < kMinFrameTime)
+    ns = kMinFrameTime;
+  if (ns > kMaxProfileTime)
+    ns = kMaxProfileTime;
+  m_historyTime = ns;
+}
+
+bool Profiler::StartSampling(uint32_t frequency)
+{
+  RegisterShutdown();
+  return m_sampler.Start(frequency, m_managers.load(std::memory_order_acquire));
+}
+
+void Profiler::StopSampling()
+{
+  m_sampler.Stop(m_managers.load(std::memory_order_acquire));
+}
+
+void Profiler::BeginEvent(uint32_t nameID)
+{
+  ProfilerEventManager* mngr = GetEventManager();
+  if (mngr != nullptr)
+    mngr->PushEvent(nameID);
+}
+
+void Profiler::BeginEvent(uint32_t color, const char* aName)
 {
-	return GetEventManager()->PushEvent(color, aName);
+  ProfilerEventManager* mngr = GetEventManager();
+  if (mngr != nullptr)
+    mngr->PushEvent(NameRegistry::Get()->Register(aName, color));
 }
 
 void Profiler::EndEvent()
 {
-  GetEventManager()->PopEvent();
+  // Events still open when the thread exited were already ended by its ManagerRetirer
+  ProfilerEventManager* mngr = GetEventManager();
+  if (mngr != nullptr)
+    mngr->PopEvent();
 }
 
 void Profiler::BeginFrame()
 {
 	// Get current time
-	m_frameStart = std::chrono::high_resolution_clock::now();
-  unsigned long long currTime = (m_frameStart - Timer::GetGlobalStartTime()).count();
+	m_frameStart = Timer::Now();
+  unsigned long long currTime = m_frameStart;
+  unsigned long long maxProfileTicks = Timer::NsToTicks((double)m_historyTime);
 
-	// Remove outdated frame times
-  for (auto it = m_frameTimes.begin(); it != m_frameTimes.end();)
-  {
-    if (currTime > kMaxProfileTime && it->startTime + it->duration < (currTime - kMaxProfileTime))
-      it = m_frameTimes.erase(it);
-    else
-      it++;
-  }
+	// Remove outdated frame times, they are ordered so we can stop at the first one that's still inside the buffer
+  while (!m_frameTimes.Empty() && currTime > maxProfileTicks && m_frameTimes.Front().startTime + m_frameTimes.Front().duration < (currTime - maxProfileTicks))
+    m_frameTimes.PopFront();
 
   // start new frame
   FrameTime ft;
 	ft.startTime = currTime;
   ft.duration = 0;
-  m_frameTimes.push_back(ft);
+  m_frameTimes.PushBack(ft);
+
+  // Sample new threads before their events can be captured
+  if (m_sampler.IsRunning())
+    m_sampler.Update(m_managers.load(std::memory_order_acquire));
 
   // Remove outdated events
   ClearOutdatedEvents();
@@ -203,335 +427,827 @@ void Profiler::BeginFrame()
 
 void Profiler::EndFrame()
 {
-	std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
-	auto elaps = end - m_frameStart;
-	FrameTime& frame = m_frameTimes.back();
-	frame.duration = (elaps).count();
-	frame.color = IM_COL32(rand() % 255, rand() % 255, rand() % 255, 255); // TODO - scale based on duration? e.g. red when frame is long
+	unsigned long long end = Timer::Now();
+	FrameTime& frame = m_frameTimes.Back();
+	frame.duration = end - m_frameStart;
+	frame.color = NameRegistry::MakeColor(rand() % 255, rand() % 255, rand() % 255); // TODO - scale based on duration? e.g. red when frame is long
+
+  if (m_streamWriter.IsRunning())
+    m_streamWriter.AddFrame(frame.startTime, frame.duration, frame.color);
 
 	// Update fps counter
-	m_framesPerSecond = 1e9 / frame.duration;
+	m_framesPerSecond = (float)(1e9 / Timer::TicksToNs(frame.duration));
 }
 
 void Profiler::ClearOutdatedEvents()
 {
-  unsigned long long currTime = (m_frameStart - Timer::GetGlobalStartTime()).count();
+  unsigned long long currTime = m_frameStart;
+  unsigned long long maxProfileTicks = Timer::NsToTicks((double)m_historyTime);
+
+  unsigned long long cutoffTime = currTime > maxProfileTicks ? currTime - maxProfileTicks : 0;
 
-  for (auto it = m_managers.begin(); it != m_managers.end(); it++)
+  ProfilerEventManager* prev = nullptr;
+  for (ProfilerEventManager* mngr = m_managers.load(std::memory_order_acquire); mngr != nullptr;)
   {
-    std::vector<MemoryPager::Page*> &pages = (*it)->GetPages();
+    ProfilerEventManager* nextManager = mngr->GetNext();
+    bool retired = mngr->IsRetired(); // check before reading pages, so we see everything the thread wrote
+    MemoryPager::PageList &pages = mngr->GetPages();
+    uint32_t recordSize = mngr->GetRecordSize();
 
     // Check each page for outdated events
-    for (auto p = pages.begin(); p != pages.end();)
+    for (MemoryPager::Page* page = pages.Front(); page != nullptr;)
     {
-      MemoryPager::Page* page = *p;
-      page->bufferCurrent = page->bufferStart + page->bufferReadOffset;
-			while (page->bufferReadOffset < page->bufferWriteOffset)
+      // The last page is still being written to unless the thread exited. Check this before loading
+      // the write offset, since pages that got a successor won't receive new records anymore
+      MemoryPager::Page* next = MemoryPager::PageList::Next(page);
+      bool isComplete = next != nullptr || retired;
+      uint32_t writeOffset = page->bufferWriteOffset.load(std::memory_order_acquire);
+
+      // Full pages get streamed before they can expire, records that weren't streamed yet never expire
+      uint32_t expireOffset = writeOffset;
+      if (m_streamWriter.IsRunning())
+      {
+        if (isComplete)
+          StreamPage(mngr, page, writeOffset);
+        expireOffset = std::min(writeOffset, std::max(page->bufferStreamOffset, page->bufferReadOffset));
+      }
+
+			while (page->bufferReadOffset < expireOffset)
 			{
-				ProfilerEventManager::ProfilerEvent* ev = reinterpret_cast<ProfilerEventManager::ProfilerEvent*>(page->bufferCurrent);
-				if (currTime < kMaxProfileTime || ev->startTime + ev->duration >= currTime - kMaxProfileTime)
+				if (!mngr->IsRecordOutdated(page->bufferStart + page->bufferReadOffset, cutoffTime))
           break;
 
-        page->bufferReadOffset += sizeof(ProfilerEventManager::ProfilerEvent);
-				page->bufferCurrent = page->bufferStart + page->bufferReadOffset;
+        page->bufferReadOffset += recordSize;
       }
 
       // Check if page is fully outdated, and release if it is
-      if (page->bufferReadOffset >= page->bufferWriteOffset)
+      if (page->bufferReadOffset >= writeOffset && isComplete)
       {
-        p = pages.erase(p);
+        pages.Remove(page);
         MemoryPager::Get()->ReleasePage(page);
       }
-      else
-        p++;
+
+      page = next;
     }
+
+    ClearOutdatedRecords(mngr->GetSamplePages(), sizeof(ProfilerEventManager::Sample), cutoffTime, retired);
+    ClearOutdatedRecords(mngr->GetAllocPages(), sizeof(ProfilerEventManager::AllocRecord), cutoffTime, retired);
+    ClearOutdatedRecords(mngr->GetLockPages(), sizeof(ProfilerEventManager::LockRecord), cutoffTime, retired);
+
+    // Delete managers of exited threads once all their events expired
+    if (retired && pages.Empty() && mngr->GetSamplePages().Empty() && mngr->GetAllocPages().Empty() && mngr->GetLockPages().Empty())
+    {
+      m_sampler.RemoveThread(mngr);
+      UnregisterManager(mngr, prev);
+      delete mngr;
+    }
+    else
+      prev = mngr;
+
+    mngr = nextManager;
   }
 }
 
-void Profiler::GetCurrentCapture()
+void Profiler::ClearOutdatedRecords(MemoryPager::PageList &pages, uint32_t recordSize, unsigned long long cutoffTime, bool retired)
 {
-  // Clear old capture data
-  m_numEventsInCapture = 0;
-  for (auto it = m_captureInfo.begin(); it != m_captureInfo.end(); it++)
+  for (MemoryPager::Page* page = pages.Front(); page != nullptr;)
   {
-    for (auto p = it->pages.begin(); p != it->pages.end(); p++)
-      MemoryPager::Get()->ReleasePage(*p);
+    MemoryPager::Page* next = MemoryPager::PageList::Next(page);
+    bool isComplete = next != nullptr || retired;
+    uint32_t writeOffset = page->bufferWriteOffset.load(std::memory_order_acquire);
+
+    while (page->bufferReadOffset < writeOffset)
+    {
+      const unsigned long long* timestamp = reinterpret_cast<const unsigned long long*>(page->bufferStart + page->bufferReadOffset);
+      if (*timestamp >= cutoffTime)
+        break;
+      page->bufferReadOffset += recordSize;
+    }
+
+    if (page->bufferReadOffset >= writeOffset && isComplete)
+    {
+      pages.Remove(page);
+      MemoryPager::Get()->ReleasePage(page);
+    }
+
+    page = next;
   }
-  m_captureInfo.clear();
+}
 
-	std::chrono::high_resolution_clock::time_point captureTime = std::chrono::high_resolution_clock::now();
-	m_captureTime = (captureTime - Timer::GetGlobalStartTime()).count();
+void Profiler::GetCurrentCapture()
+{
+  // Only build one capture at a time
+  if (m_captureThread.joinable())
+    return;
 
-  // Get current data
-  for (auto pem = m_managers.begin(); pem != m_managers.end(); pem++)
-  {
-    ProfilerEventManager* mngr = *pem;
-    std::vector<MemoryPager::Page*> &pages = mngr->GetPages();
+  RegisterShutdown();
 
-    m_captureInfo.push_back(ThreadEventInfo());
-    ThreadEventInfo &info = m_captureInfo.back();
-    strcpy_s(info.threadName, mngr->GetThreadName());
+  Capture* capture = new Capture();
+	capture->captureTime = Timer::Now();
+  m_captureProgress = 0;
+  m_captureProgressTotal = 0;
+
+  // Snapshot the current data, the heavy lifting is done on the capture thread
+  for (ProfilerEventManager* mngr = m_managers.load(std::memory_order_acquire); mngr != nullptr; mngr = mngr->GetNext())
+  {
+    capture->threads.push_back(ThreadEventInfo());
+    ThreadEventInfo &info = capture->threads.back();
+    snprintf(info.threadName, sizeof(info.threadName), "%s", mngr->GetThreadName());
     info.threadID = mngr->GetThreadID();
     info.maxDepth = 0;
+    info.longestLockHold = 0;
+    info.format = mngr->GetFormat();
+
+    SnapshotPages(mngr, info);
+    SnapshotPageList(mngr->GetSamplePages(), info, info.samplePageRanges);
+    SnapshotPageList(mngr->GetAllocPages(), info, info.allocPageRanges);
+    SnapshotPageList(mngr->GetLockPages(), info, info.lockPageRanges);
+    m_captureProgressTotal += (uint32_t)info.pageRanges.size();
+  }
+
+  capture->frameTimes.resize(m_frameTimes.Size());
+  for (uint32_t i = 0; i < m_frameTimes.Size(); i++)
+    capture->frameTimes[i] = m_frameTimes[i];
+
+  m_captureThread = std::thread(&Profiler::BuildCapture, this, capture);
+}
+
+void Profiler::BuildCapture(Capture* capture)
+{
+  for (auto it = capture->threads.begin(); it != capture->threads.end(); it++)
+  {
+    ThreadEventInfo &info = *it;
+
+    if (info.format == ProfilerEventManager::kRecordStream)
+      CaptureStreamPages(info);
+    else
+      CaptureEventPages(info);
+    CaptureSamplePages(info);
+    CaptureAllocPages(info);
+    CaptureLockPages(info, capture->captureTime);
+  }
+
+  FinishCapture(capture);
+
+  m_finishedCapture.store(capture, std::memory_order_release);
+}
+
+void Profiler::FinishCapture(Capture* capture)
+{
+  for (auto it = capture->threads.begin(); it != capture->threads.end(); it++)
+  {
+    ThreadEventInfo &info = *it;
 
-    // Copy all pages
-    for (auto p = pages.begin(); p != pages.end(); p++)
+    // Split events per depth. Events on the same depth never overlap, so these stay sorted by end time as well
+    info.depthEvents.resize(info.events.empty() ? 0 : info.maxDepth + 1);
+    for (auto ev = info.events.begin(); ev != info.events.end(); ev++)
+      info.depthEvents[(*ev)->depth].push_back(*ev);
+
+    BuildLodLevels(info);
+
+    capture->numEvents += (uint32_t)info.events.size();
+  }
+
+  BuildScopeStats(capture);
+  BuildCallTree(capture);
+  BuildHeapTimeline(capture);
+
+  // get longest frame time
+  for (auto it = capture->frameTimes.begin(); it != capture->frameTimes.end(); it++)
+  {
+    if (it->duration > capture->longestFrame.duration)
+      capture->longestFrame = *it;
+  }
+}
+
+void Profiler::BuildScopeStats(Capture* capture)
+{
+  ScopeStatsBuilder builder;
+  for (auto it = capture->threads.begin(); it != capture->threads.end(); it++)
+  {
+    builder.BeginThread();
+    for (auto ev = it->events.begin(); ev != it->events.end(); ev++)
+      builder.AddEvent((*ev)->startTime, (*ev)->duration, (*ev)->nameID, (*ev)->depth);
+
+    // Allocations count for the innermost event they happened in
+    for (auto alloc = it->allocations.begin(); alloc != it->allocations.end(); alloc++)
+    {
+      if ((*alloc)->type == ProfilerEventManager::kAlloc && (*alloc)->nameID != NameRegistry::kInvalidNameID)
+        builder.AddAllocation((*alloc)->nameID, (*alloc)->bytes);
+    }
+  }
+  builder.Finish(capture->scopeStats);
+}
+
+void Profiler::BuildHeapTimeline(Capture* capture)
+{
+  for (auto it = capture->threads.begin(); it != capture->threads.end(); it++)
+  {
+    for (auto alloc = it->allocations.begin(); alloc != it->allocations.end(); alloc++)
     {
-      MemoryPager::Page* page = *p;
-      MemoryPager::Page* newPage = MemoryPager::Get()->GetPage();
-
-      // Copy page data into new page
-      memcpy(newPage->bufferStart, page->bufferStart, page->bufferWriteOffset);
-      newPage->bufferReadOffset = page->bufferReadOffset;
-      newPage->bufferWriteOffset = page->bufferWriteOffset;
-      info.pages.push_back(newPage);
-
-      // Extract events from new page
-      uint32_t currRead = newPage->bufferReadOffset;
-      newPage->bufferCurrent = newPage->bufferStart + currRead;
-      while (currRead < newPage->bufferWriteOffset)
+      HeapPoint point = { (*alloc)->timestamp, (*alloc)->liveBytes };
+      capture->heapTimeline.push_back(point);
+    }
+  }
+
+  // Threads update the live heap in the order they got to the shared counter, which is close to timestamp order
+  std::sort(capture->heapTimeline.begin(), capture->heapTimeline.end(), [](const HeapPoint& a, const HeapPoint& b) { return a.timestamp < b.timestamp; });
+  for (auto it = capture->heapTimeline.begin(); it != capture->heapTimeline.end(); it++)
+    capture->maxLiveBytes = std::max(capture->maxLiveBytes, it->liveBytes);
+}
+
+void Profiler::BuildCallTree(Capture* capture)
+{
+  CallTreeBuilder builder;
+  for (auto it = capture->threads.begin(); it != capture->threads.end(); it++)
+  {
+    builder.BeginThread();
+    for (auto ev = it->events.begin(); ev != it->events.end(); ev++)
+      builder.AddEvent((*ev)->startTime, (*ev)->duration, (*ev)->nameID, (*ev)->depth);
+  }
+  builder.Finish(capture->callTree);
+}
+
+void Profiler::TakeCapture(bool wait)
+{
+  // A capture that's still being built is older than this call, so it's finished first and a new one is taken
+  if (m_captureThread.joinable())
+  {
+    if (!wait)
+      return;
+    m_captureThread.join();
+    UpdateCapture();
+  }
+
+  GetCurrentCapture();
+  if (wait)
+  {
+    m_captureThread.join();
+    UpdateCapture();
+  }
+}
+
+void Profiler::UpdateCapture()
+{
+  Capture* capture = m_finishedCapture.exchange(nullptr, std::memory_order_acquire);
+  if (capture == nullptr)
+    return;
+
+  if (m_captureThread.joinable())
+    m_captureThread.join();
+
+  ReleaseCapture(m_capture.get());
+  m_capture.reset(capture);
+}
+
+bool Profiler::SaveCapture(const char* path)
+{
+  Capture* capture = m_capture.get();
+
+  CaptureFileWriter writer;
+  if (!writer.Open(path))
+    return false;
+
+  writer.WriteNewNames();
+  writer.WriteCaptureTime(capture->captureTime);
+
+  writer.BeginFrames();
+  for (auto it = capture->frameTimes.begin(); it != capture->frameTimes.end(); it++)
+    writer.WriteFrame(it->startTime, it->duration, it->color);
+  writer.EndFrames();
+
+  // Events are already sorted by start time, which keeps the deltas small
+  for (uint32_t i = 0; i < capture->threads.size(); i++)
+  {
+    ThreadEventInfo &info = capture->threads[i];
+    writer.WriteThread(i, info.threadID, info.threadName);
+
+    writer.BeginEvents(i);
+    for (auto ev = info.events.begin(); ev != info.events.end(); ev++)
+      writer.WriteEvent((*ev)->startTime, (*ev)->duration, (*ev)->nameID, (*ev)->depth);
+    writer.EndEvents();
+  }
+
+  return writer.Close();
+}
+
+bool Profiler::LoadCapture(const char* path)
+{
+  // The capture thread would replace the loaded capture once it's done
+  if (m_captureThread.joinable())
+    return false;
+
+  CaptureFileReader reader;
+  if (!reader.Open(path))
+    return false;
+
+  std::unique_ptr<Capture> capture(new Capture());
+  capture->fileName = path;
+
+  // Files can come from machines with a different timer frequency
+  double tickScale = (double)Timer::NsToTicks(1e9) / reader.GetTicksPerSecond();
+  auto toLocalTicks = [tickScale](unsigned long long ticks) { return tickScale == 1.0 ? ticks : (unsigned long long)(ticks * tickScale); };
+
+  std::vector<uint32_t> nameIDs; // file name ID to registry name ID
+  std::vector<MemoryPager::Page*> eventPages; // page events are added to, per thread
+  std::vector<std::vector<ProfilerEventManager::ProfilerEvent*>> eventStacks; // open events of token blocks by depth, per thread
+  bool hasCaptureTime = false;
+  unsigned long long lastTime = 0;
+
+  // Threads are added when they're first referenced, in case their thread block comes later
+  auto getThread = [&](uint32_t threadIndex) -> ThreadEventInfo&
+  {
+    for (uint32_t i = (uint32_t)capture->threads.size(); i <= threadIndex; i++)
+    {
+      capture->threads.push_back(ThreadEventInfo());
+      ThreadEventInfo &info = capture->threads.back();
+      snprintf(info.threadName, sizeof(info.threadName), "Thread %u", i);
+      info.threadID = 0;
+      info.maxDepth = 0;
+      info.longestLockHold = 0;
+      info.format = ProfilerEventManager::kRecordEvents;
+      eventPages.push_back(nullptr);
+      eventStacks.push_back(std::vector<ProfilerEventManager::ProfilerEvent*>());
+    }
+    return capture->threads[threadIndex];
+  };
+
+  CaptureFileReader::Block block;
+  while (reader.NextBlock(block))
+  {
+    switch (block.type)
+    {
+    case CaptureFile::kBlockNames:
+    {
+      uint32_t id, color;
+      std::string name;
+      while (CaptureFileReader::ReadName(block, id, color, name))
       {
-				ProfilerEventManager::ProfilerEvent* ev = reinterpret_cast<ProfilerEventManager::ProfilerEvent*>(newPage->bufferCurrent);
-        info.events.push_back(ev);
-        currRead += sizeof(ProfilerEventManager::ProfilerEvent);
-        newPage->bufferCurrent += sizeof(ProfilerEventManager::ProfilerEvent);
+        if (id >= kMaxLoadedNames)
+          continue;
+        if (id >= nameIDs.size())
+          nameIDs.resize((size_t)id + 1, (uint32_t)NameRegistry::kInvalidNameID);
+        nameIDs[id] = NameRegistry::Get()->Register(name.c_str(), color);
+      }
+      break;
+    }
+    case CaptureFile::kBlockThread:
+    {
+      uint32_t threadIndex, threadID;
+      std::string name;
+      if (!CaptureFileReader::ReadThread(block, threadIndex, threadID, name) || threadIndex >= kMaxLoadedThreads)
+        break;
+
+      ThreadEventInfo &info = getThread(threadIndex);
+      snprintf(info.threadName, sizeof(info.threadName), "%s", name.c_str());
+      info.threadID = threadID;
+      break;
+    }
+    case CaptureFile::kBlockEvents:
+    {
+      uint32_t threadIndex;
+      if (!CaptureFileReader::ReadEventThread(block, threadIndex) || threadIndex >= kMaxLoadedThreads)
+        break;
+
+      ThreadEventInfo &info = getThread(threadIndex);
+      unsigned long long startTime, duration;
+      uint32_t nameID, depth;
+      while (CaptureFileReader::ReadEvent(block, startTime, duration, nameID, depth))
+      {
+        if (depth >= kMaxLoadedDepth)
+          continue;
 
-        if (ev->depth > info.maxDepth)
-          info.maxDepth = ev->depth;
+        nameID = nameID < nameIDs.size() ? nameIDs[nameID] : NameRegistry::kInvalidNameID;
+        AddCaptureEvent(info, eventPages[threadIndex], toLocalTicks(startTime), toLocalTicks(duration), nameID, depth);
+        lastTime = std::max(lastTime, toLocalTicks(startTime + duration));
+      }
+      break;
+    }
+    case CaptureFile::kBlockTokens:
+    {
+      // Streamed files can contain begin / end tokens, the nesting is restored like CaptureStreamPages does
+      uint32_t threadIndex;
+      if (!CaptureFileReader::ReadEventThread(block, threadIndex) || threadIndex >= kMaxLoadedThreads)
+        break;
+
+      ThreadEventInfo &info = getThread(threadIndex);
+      std::vector<ProfilerEventManager::ProfilerEvent*> &openEvents = eventStacks[threadIndex];
+      unsigned long long timestamp;
+      uint32_t nameID, depth;
+      bool isEnd;
+      while (CaptureFileReader::ReadToken(block, timestamp, nameID, depth, isEnd))
+      {
+        timestamp = toLocalTicks(timestamp);
+        lastTime = std::max(lastTime, timestamp);
+
+        // Events that are nested too deep are skipped along with their end token
+        if (depth >= kMaxLoadedDepth)
+          continue;
+
+        if (isEnd)
+        {
+          if (depth < openEvents.size() && openEvents[depth] != nullptr)
+          {
+            ProfilerEventManager::ProfilerEvent* ev = openEvents[depth];
+            ev->duration = timestamp > ev->startTime ? timestamp - ev->startTime : 0;
+            openEvents.resize(depth);
+          }
+          continue;
+        }
+
+        nameID = nameID < nameIDs.size() ? nameIDs[nameID] : NameRegistry::kInvalidNameID;
+        openEvents.resize(depth + 1, nullptr);
+        openEvents[depth] = AddCaptureEvent(info, eventPages[threadIndex], timestamp, ProfilerEventManager::kOpenEventDuration, nameID, depth);
+      }
+      break;
+    }
+    case CaptureFile::kBlockFrames:
+    {
+      FrameTime frame;
+      unsigned long long startTime, duration;
+      uint32_t color;
+      while (CaptureFileReader::ReadFrame(block, startTime, duration, color))
+      {
+        frame.startTime = toLocalTicks(startTime);
+        frame.duration = toLocalTicks(duration);
+        frame.color = (int32_t)color;
+        capture->frameTimes.push_back(frame);
+        lastTime = std::max(lastTime, frame.startTime + frame.duration);
+      }
+      break;
+    }
+    case CaptureFile::kBlockCaptureTime:
+    {
+      unsigned long long captureTime;
+      if (CaptureFileReader::ReadCaptureTime(block, captureTime))
+      {
+        capture->captureTime = toLocalTicks(captureTime);
+        hasCaptureTime = true;
       }
+      break;
     }
+    default:
+      break; // skip blocks added by newer versions
+    }
+  }
+
+  if (!hasCaptureTime)
+    capture->captureTime = lastTime;
 
-    m_numEventsInCapture += (uint32_t)info.events.size();
+  // Drop token events that never ended
+  auto isOpen = [](ProfilerEventManager::ProfilerEvent* ev) { return ev->duration == ProfilerEventManager::kOpenEventDuration; };
+  for (auto it = capture->threads.begin(); it != capture->threads.end(); it++)
+    it->events.erase(std::remove_if(it->events.begin(), it->events.end(), isOpen), it->events.end());
+
+  // Blocks don't have to be in order, so restore the sorting the capture relies on
+  // Parents go before children that start at the same time
+  auto startsBefore = [](const ProfilerEventManager::ProfilerEvent* a, const ProfilerEventManager::ProfilerEvent* b) { return a->startTime < b->startTime || (a->startTime == b->startTime && a->depth < b->depth); };
+  for (auto it = capture->threads.begin(); it != capture->threads.end(); it++)
+  {
+    if (!std::is_sorted(it->events.begin(), it->events.end(), startsBefore))
+      std::stable_sort(it->events.begin(), it->events.end(), startsBefore);
   }
+  auto frameStartsBefore = [](const FrameTime& a, const FrameTime& b) { return a.startTime < b.startTime; };
+  if (!std::is_sorted(capture->frameTimes.begin(), capture->frameTimes.end(), frameStartsBefore))
+    std::stable_sort(capture->frameTimes.begin(), capture->frameTimes.end(), frameStartsBefore);
 
-  // get longest frame time
-  m_captureFrameTimes = m_frameTimes;
-  m_longestFrame.duration = 0;
-  for (auto it = m_captureFrameTimes.begin(); it != m_captureFrameTimes.end(); it++)
+  FinishCapture(capture.get());
+
+  ReleaseCapture(m_capture.get());
+  m_capture = std::move(capture);
+  return true;
+}
+
+bool Profiler::ExportTrace(const char* path, TraceWriter::Format format)
+{
+  Capture* capture = m_capture.get();
+
+  std::unique_ptr<TraceWriter> writer(TraceWriter::Create(format, path));
+  if (!writer)
+    return false;
+
+  // Ends are converted separately, so nested events keep ending inside their parent
+  auto toNs = [](unsigned long long ticks) { return (unsigned long long)Timer::TicksToNs(ticks); };
+
+  writer->BeginTrack(0, "Frames", 0);
+  for (auto it = capture->frameTimes.begin(); it != capture->frameTimes.end(); it++)
+    writer->WriteFrame(toNs(it->startTime), toNs(it->startTime + it->duration) - toNs(it->startTime));
+  writer->EndTrack();
+
+  for (uint32_t i = 0; i < capture->threads.size(); i++)
   {
-    if (it->duration > m_longestFrame.duration)
-      m_longestFrame = *it;
+    ThreadEventInfo &info = capture->threads[i];
+
+    writer->BeginTrack(i + 1, info.threadName, info.threadID);
+    for (auto it = info.events.begin(); it != info.events.end(); it++)
+    {
+      const ProfilerEventManager::ProfilerEvent* ev = *it;
+      unsigned long long startTime = toNs(ev->startTime);
+      writer->WriteSlice(startTime, toNs(ev->startTime + ev->duration) - startTime, ev->nameID, ev->depth);
+    }
+    writer->EndTrack();
   }
-}
-
-void Profiler::Render()
+
+  return writer->Close();
+}
+
+void Profiler::ReleaseCapture(Capture* capture)
 {
-	UpdateZoom();
-  ImGuiIO io = ImGui::GetIO();
+  for (auto it = capture->threads.begin(); it != capture->threads.end(); it++)
+  {
+    for (auto p = it->pages.begin(); p != it->pages.end(); p++)
+      MemoryPager::Get()->ReleasePage(*p);
+  }
+}
+
+void Profiler::StreamPage(ProfilerEventManager* mngr, MemoryPager::Page* page, uint32_t writeOffset)
+{
+  // Records before the read offset expired before streaming started
+  uint32_t readOffset = std::max(page->bufferStreamOffset, page->bufferReadOffset);
+  if (readOffset >= writeOffset)
+    return;
+
+  if (mngr->m_streamIndex == ProfilerEventManager::kInvalidStreamIndex)
+  {
+    mngr->m_streamIndex = m_numStreamedThreads++;
+    m_streamWriter.AddThread(mngr->m_streamIndex, mngr->GetThreadID(), mngr->GetThreadName());
+  }
+
+  MemoryPager::Get()->RetainPage(page);
+  m_streamWriter.AddPage(mngr->m_streamIndex, mngr->GetFormat() != ProfilerEventManager::kRecordStream, mngr->GetRecordSize(), page, readOffset, writeOffset);
+  page->bufferStreamOffset = writeOffset;
+}
+
+bool Profiler::StartStreaming(const char* path)
+{
+  if (m_streamWriter.IsRunning())
+    return false;
+
+  RegisterShutdown();
+
+  // Thread indices are per file
+  m_numStreamedThreads = 0;
+  for (ProfilerEventManager* mngr = m_managers.load(std::memory_order_acquire); mngr != nullptr; mngr = mngr->GetNext())
+    mngr->m_streamIndex = ProfilerEventManager::kInvalidStreamIndex;
+
+  return m_streamWriter.Start(path);
+}
+
+void Profiler::StopStreaming()
+{
+  if (!m_streamWriter.IsRunning())
+    return;
+
+  // Pages that are still being written to only get streamed up to this point
+  for (ProfilerEventManager* mngr = m_managers.load(std::memory_order_acquire); mngr != nullptr; mngr = mngr->GetNext())
+  {
+    MemoryPager::PageList &pages = mngr->GetPages();
+    for (MemoryPager::Page* page = pages.Front(); page != nullptr; page = MemoryPager::PageList::Next(page))
+      StreamPage(mngr, page, page->bufferWriteOffset.load(std::memory_order_acquire));
+  }
+
+  m_streamWriter.Stop();
+}
 
-  ImGui::SetNextWindowPos(ImVec2(io.DisplaySize.x * 0.1f, io.DisplaySize.y * 0.1f), ImGuiSetCond_Once);
-  ImGui::SetNextWindowSize(ImVec2(io.DisplaySize.x * 0.8f, io.DisplaySize.y * 0.8f), ImGuiSetCond_Once);
+void Profiler::SnapshotPages(ProfilerEventManager* mngr, ThreadEventInfo &info)
+{
+  SnapshotPageList(mngr->GetPages(), info, info.pageRanges);
+}
 
-  ImGui::Begin("Profiler", &m_isOpen);
+void Profiler::SnapshotPageList(MemoryPager::PageList &pages, ThreadEventInfo &info, std::vector<PageRange> &ranges)
+{
+  for (MemoryPager::Page* page = pages.Front(); page != nullptr; page = MemoryPager::PageList::Next(page))
+  {
+    // Published records never move, so even the page the manager is writing to can be shared.
+    // Only the records up to the write offset loaded here are part of the capture
+    PageRange range;
+    range.page = page;
+    range.readOffset = page->bufferReadOffset;
+    range.writeOffset = page->bufferWriteOffset.load(std::memory_order_acquire);
+
+    MemoryPager::Get()->RetainPage(page);
+    info.pages.push_back(range.page);
+    ranges.push_back(range);
+  }
+}
+
+void Profiler::CaptureEventPages(ThreadEventInfo &info)
+{
+  uint32_t recordSize = ProfilerEventManager::GetRecordSize(info.format);
+  for (auto range = info.pageRanges.begin(); range != info.pageRanges.end(); range++)
+  {
+    m_captureProgress.fetch_add(1, std::memory_order_relaxed);
+    // Extract events from the page
+    uint32_t currRead = range->readOffset;
+    while (currRead < range->writeOffset)
+    {
+      ProfilerEventManager::ProfilerEvent* ev = reinterpret_cast<ProfilerEventManager::ProfilerEvent*>(range->page->bufferStart + currRead);
+      currRead += recordSize;
+
+      // Skip events that haven't ended yet, and empty ones
+      unsigned long long duration = ev->duration.load(std::memory_order_acquire);
+      if (duration == ProfilerEventManager::kOpenEventDuration || duration == 0)
+        continue;
+      info.events.push_back(ev);
+
+      if (ev->depth > info.maxDepth)
+        info.maxDepth = ev->depth;
+    }
+  }
+}
+
+void Profiler::CaptureSamplePages(ThreadEventInfo &info)
+{
+  for (auto range = info.samplePageRanges.begin(); range != info.samplePageRanges.end(); range++)
+  {
+    for (uint32_t currRead = range->readOffset; currRead < range->writeOffset; currRead += sizeof(ProfilerEventManager::Sample))
+      info.samples.push_back(reinterpret_cast<const ProfilerEventManager::Sample*>(range->page->bufferStart + currRead));
+  }
+}
 
-  // Capture button
-  ImGui::PushItemWidth(ImGui::GetWindowSize().x * 0.1f);
-  if (ImGui::Button("Show Capture"))
-  {
-    GetCurrentCapture();
-  }
-  ImGui::PopItemWidth();
+void Profiler::CaptureAllocPages(ThreadEventInfo &info)
+{
+  for (auto range = info.allocPageRanges.begin(); range != info.allocPageRanges.end(); range++)
+  {
+    for (uint32_t currRead = range->readOffset; currRead < range->writeOffset; currRead += sizeof(ProfilerEventManager::AllocRecord))
+      info.allocations.push_back(reinterpret_cast<const ProfilerEventManager::AllocRecord*>(range->page->bufferStart + currRead));
+  }
+}
 
-  ImGui::SameLine();
+void Profiler::CaptureLockPages(ThreadEventInfo &info, unsigned long long captureTime)
+{
+  // A thread waits for one lock at a time, so an acquire ends the last wait
+  bool waiting = false;
 
-  ImGui::PushItemWidth(ImGui::GetWindowSize().x * 0.25f);
-  enum ProfilerType : int { kShowLongestFrame = 0, kLongestFrameWithMargin, kLastXMilliseconds };
-  const char* comboItems[] = { "Show Longest Frame", "Show Longest Frame with Margin", "Show Last X Amount of Time" };
-  static int type = kLastXMilliseconds;
-  ImGui::Combo("Profile Mode", &type, comboItems, 3);
-  ImGui::PopItemWidth();
-
-  // Render profiler type data
-  if (type == kLongestFrameWithMargin)
+  for (auto range = info.lockPageRanges.begin(); range != info.lockPageRanges.end(); range++)
   {
-    ImGui::PushItemWidth(ImGui::GetWindowSize().x * 0.1f);
-    ImGui::SameLine();
-    ImGui::InputInt("Preceding frame time", &m_precedingFrameTime);
-    ImGui::SameLine();
-    ImGui::InputInt("Proceding frame time", &m_procedingFrameTime);
-    ImGui::PopItemWidth();
+    for (uint32_t currRead = range->readOffset; currRead < range->writeOffset; currRead += sizeof(ProfilerEventManager::LockRecord))
+    {
+      const ProfilerEventManager::LockRecord* record = reinterpret_cast<const ProfilerEventManager::LockRecord*>(range->page->bufferStart + currRead);
+      LockSegment segment = { record->startTime, record->timestamp, record->lockID, record->nameID, record->holderThreadID, record->shared != 0 };
+
+      switch (record->type)
+      {
+      case ProfilerEventManager::kLockWait:
+        segment.endTime = captureTime; // still waiting unless an acquire follows
+        info.lockWaits.push_back(segment);
+        waiting = true;
+        break;
+      case ProfilerEventManager::kLockAcquired:
+        // The wait record may have expired already
+        if (waiting && info.lockWaits.back().lockID == record->lockID)
+          info.lockWaits.back().endTime = record->timestamp;
+        else
+        {
+          segment.holderThreadID = 0;
+          info.lockWaits.push_back(segment);
+        }
+        waiting = false;
+        break;
+      case ProfilerEventManager::kLockReleased:
+        info.lockHolds.push_back(segment);
+        info.longestLockHold = std::max(info.longestLockHold, segment.endTime - segment.startTime);
+        break;
+      default:
+        break;
+      }
+    }
   }
-  else if (type == kLastXMilliseconds)
+}
+
+void Profiler::CaptureStreamPages(ThreadEventInfo &info)
+{
+  // Reconstructed events are written into capture pages in begin order, and patched when their end token is found.
+  // The open events are indexed by the tokens' depth, the snapshot can start below the outermost open event
+  MemoryPager::Page* eventPage = nullptr;
+  std::vector<ProfilerEventManager::ProfilerEvent*> openEvents;
+
+  for (auto range = info.pageRanges.begin(); range != info.pageRanges.end(); range++)
   {
-    ImGui::PushItemWidth(ImGui::GetWindowSize().x * 0.1f);
-    ImGui::SameLine();
-    ImGui::InputInt("Time in MS", &m_lastXAmountOfTime);
-    ImGui::PopItemWidth();
+    m_captureProgress.fetch_add(1, std::memory_order_relaxed);
+    uint32_t currRead = range->readOffset;
+    while (currRead < range->writeOffset)
+    {
+      const ProfilerEventManager::StreamToken* token = reinterpret_cast<const ProfilerEventManager::StreamToken*>(range->page->bufferStart + currRead);
+      currRead += sizeof(ProfilerEventManager::StreamToken);
+
+      uint32_t depth = token->depth;
+      if (token->type == ProfilerEventManager::kTokenEnd)
+      {
+        // End tokens whose begin token already expired are dropped
+        if (depth < openEvents.size() && openEvents[depth] != nullptr)
+        {
+          ProfilerEventManager::ProfilerEvent* ev = openEvents[depth];
+          ev->duration = token->timestamp - ev->startTime;
+          openEvents.resize(depth);
+        }
+        continue;
+      }
+
+      openEvents.resize(depth + 1, nullptr);
+      openEvents[depth] = AddCaptureEvent(info, eventPage, token->timestamp, ProfilerEventManager::kOpenEventDuration, token->nameID, depth);
+    }
   }
 
-  ImGui::Text("Showing %u events for %u threads, %u Pages created, total mem: %s", m_numEventsInCapture, m_managers.size(), MemoryPager::Get()->GetNumPages(), BytesToSize((float)MemoryPager::Get()->GetNumPages() * MemoryPager::kPageSize).c_str());
-	ImGui::Text("FPS: %.2f", m_framesPerSecond);
+  // Skip events that haven't ended yet, an event whose slot got reused by a sibling never will
+  auto isOpen = [](ProfilerEventManager::ProfilerEvent* ev) { return ev->duration == ProfilerEventManager::kOpenEventDuration; };
+  info.events.erase(std::remove_if(info.events.begin(), info.events.end(), isOpen), info.events.end());
+}
 
-  // Setup some information we need to help display
-  unsigned long long startTime = 0;
-	unsigned long long displayTime = 0; // total time we will display for this frame
-	uint32_t displayTimeMS = 0;
-  switch (type)
+ProfilerEventManager::ProfilerEvent* Profiler::AddCaptureEvent(ThreadEventInfo &info, MemoryPager::Page*& eventPage, unsigned long long startTime, unsigned long long duration, uint32_t nameID, uint32_t depth)
+{
+  // Capture pages are private to the capture, so the write offset is only kept for bookkeeping
+  uint32_t eventOffset = eventPage != nullptr ? eventPage->bufferWriteOffset.load(std::memory_order_relaxed) : MemoryPager::kPageSize;
+  if (eventOffset + sizeof(ProfilerEventManager::ProfilerEvent) > MemoryPager::kPageSize)
   {
-  case kShowLongestFrame:
-    startTime = m_longestFrame.startTime;
-    displayTime = m_longestFrame.duration;
-    break;
-  case kLongestFrameWithMargin:
-    startTime = m_longestFrame.startTime - m_precedingFrameTime;
-    displayTime = m_precedingFrameTime + m_longestFrame.duration + m_procedingFrameTime;
-    break;
-  case kLastXMilliseconds:
-    startTime = m_captureTime - (m_lastXAmountOfTime * 1e6);
-    displayTime = (m_lastXAmountOfTime * 1e6);
-		displayTimeMS = m_lastXAmountOfTime;
-    break;
+    eventPage = MemoryPager::Get()->GetPage();
+    info.pages.push_back(eventPage);
+    eventOffset = 0;
   }
-	  
-  // Create profiler layout, will be filled with data later
-  ImGui::BeginChild("ThreadData", ImVec2(ImGui::GetWindowSize().x * 0.15f, 0), false, ImGuiWindowFlags_NoScrollbar);
-	ImGui::Text("Frame times");
-  ImGui::EndChild();
 
-  ImGui::SameLine();
+  ProfilerEventManager::ProfilerEvent* ev = reinterpret_cast<ProfilerEventManager::ProfilerEvent*>(eventPage->bufferStart + eventOffset);
+  eventPage->bufferWriteOffset.store(eventOffset + sizeof(ProfilerEventManager::ProfilerEvent), std::memory_order_relaxed);
 
-  ImGui::BeginChild("EventData", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
+  ev->startTime = startTime;
+  ev->duration.store(duration, std::memory_order_relaxed);
+  ev->nameID = nameID;
+  ev->depth = depth;
+  info.events.push_back(ev);
 
-  // Calculate clip rect
-  ImVec2 clipRectPos(ImGui::GetWindowPos());
-  ImVec2 clipRectSize(ImGui::GetWindowSize());
-  ImVec2 clipRectEnd(clipRectPos.x + clipRectSize.x, clipRectPos.y + clipRectSize.y);
+  if (depth > info.maxDepth)
+    info.maxDepth = depth;
 
-  // Start by drawing the timeline
-  // Store current cursor pos
-  ImVec2 cursorScreenPosStart = ImGui::GetCursorScreenPos();
+  return ev;
+}
 
-  // Calculate how big each MS will be displayed
-  float step = 20 + (m_zoom * 0.2f);
-  ImGui::SetCursorScreenPos(ImVec2(cursorScreenPosStart.x, ImGui::GetWindowPos().y));
-	
-	// Set the event window size
-	ImVec2 curPosStart = ImGui::GetCursorScreenPos();
-	ImGui::SetCursorScreenPos(ImVec2(curPosStart.x + (step * displayTimeMS), ImGui::GetWindowPos().y));
-	ImGui::SetCursorScreenPos(ImVec2(curPosStart.x, ImGui::GetWindowPos().y));
-	
-	// calculate visibility
-	uint32_t displayTimeStart = (int)(ImGui::GetScrollX() / step); // round down
-	uint32_t displayTimeEnd = std::fmin((int)(displayTimeStart + ImGui::GetWindowSize().x / step) + 2, displayTimeMS); // round up;
-	uint32_t displayTimeVisible = displayTimeEnd - displayTimeStart;
-
-	unsigned long long displayTimeStartActual = displayTimeStart * 1e6;
-	unsigned long long displayTimeVisibleActual = displayTimeVisible * 1e6;
-
-	// Set cursorpos to first visible ms
-	ImGui::SetCursorScreenPos(ImVec2(curPosStart.x + (step * displayTimeStart), ImGui::GetWindowPos().y));
-  for (uint32_t i = displayTimeStart; i < displayTimeEnd; i++)
-  {
-    ImVec2 curPos = ImGui::GetCursorScreenPos();
-    ImGui::Text("%i", i);
-    if ((i % 2) == 0)
-      ImGui::GetWindowDrawList()->AddRectFilled(curPos, ImVec2(curPos.x + step, curPos.y + ImGui::GetWindowSize().y), IM_COL32(50, 50, 50, 200));
-	
-    ImGui::SetCursorScreenPos(ImVec2(curPos.x + step, ImGui::GetWindowPos().y));
-  }
-  cursorScreenPosStart.y += ImGui::GetTextLineHeight();
-  ImVec2 cursorScreenPosEnd = ImVec2(cursorScreenPosStart.x + (step * displayTimeMS), cursorScreenPosStart.y);
-
-  ImGui::SetCursorScreenPos(cursorScreenPosStart);
-
-  ImGui::EndChild();
-  
-  // Draw frame times
-  ImGui::BeginChild("EventData", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
-
-	// Calculate default item height we'll be using
-	float itemHeight = (ImGui::GetWindowFontSize() + ImGui::GetStyle().FramePadding.y * 2) * 0.35f;
-	float lineheight = itemHeight * 1.2f;
-	float totalProfileLength = (float)(cursorScreenPosEnd.x - cursorScreenPosStart.x);
-
-  for (auto it = m_captureFrameTimes.begin(); it != m_captureFrameTimes.end(); it++)
-  {
-    if (it->startTime + it->duration < startTime + displayTimeStartActual)
-      continue;
-		if (it->startTime > startTime + displayTimeStartActual + displayTimeVisibleActual)
-			break;
-
-    // Frame is atleast partially inside the time we're displaying, so render it
-    // Calculate start pos
-    float startP = (float)((float)it->startTime - startTime) / displayTime;
-    ImVec2 framePos((startP * totalProfileLength) + cursorScreenPosStart.x, cursorScreenPosStart.y);
-    // Calculate size
-    ImVec2 frameSize(((float)it->duration / displayTime) * totalProfileLength, itemHeight);
-    ImVec2 frameEnd(framePos.x + frameSize.x, framePos.y + frameSize.y);
-
-    if (ImGui_ClipRect(framePos, frameEnd, clipRectPos, clipRectEnd))
+void Profiler::BuildLodLevels(ThreadEventInfo &info)
+{
+  // Start from the raw events on each depth, every level is built from the previous one
+  std::vector<std::vector<EventSpan>> eventSpans(info.depthEvents.size());
+  for (size_t depth = 0; depth < info.depthEvents.size(); depth++)
+  {
+    std::vector<ProfilerEventManager::ProfilerEvent*> &events = info.depthEvents[depth];
+    eventSpans[depth].reserve(events.size());
+    for (auto it = events.begin(); it != events.end(); it++)
     {
-      ImGui::GetWindowDrawList()->AddRectFilled(framePos, frameEnd, it->color);
-      if (ImGui_IsItemHovered(framePos, frameEnd))
+      EventSpan span = { (*it)->startTime, (*it)->startTime + (*it)->duration, (*it)->duration, (*it)->nameID, 1 };
+      eventSpans[depth].push_back(span);
+    }
+  }
+  const std::vector<std::vector<EventSpan>>* prevSpans = &eventSpans;
+
+  unsigned long long resolution = Timer::NsToTicks((double)kLodBaseResolution);
+  for (uint32_t level = 0; level < kMaxLodLevels; level++, resolution *= kLodLevelScale)
+  {
+    LodLevel lod;
+    lod.resolution = resolution;
+    lod.depthSpans.resize(prevSpans->size());
+    bool merged = false;
+    bool singleSpans = true;
+
+    for (size_t depth = 0; depth < prevSpans->size(); depth++)
+    {
+      const std::vector<EventSpan> &src = (*prevSpans)[depth];
+      std::vector<EventSpan> &dst = lod.depthSpans[depth];
+
+      // Merge short spans with their neighbours if the gap between them is short as well
+      for (auto it = src.begin(); it != src.end(); it++)
       {
-        ImGui::BeginTooltip();
-        ImGui::Text("Frame time: %.2fms", it->duration * (1.0f / 1e6));
-        ImGui::EndTooltip();
+        bool isShort = it->endTime - it->startTime < resolution;
+        if (isShort && !dst.empty())
+        {
+          EventSpan &last = dst.back();
+          if (last.endTime - last.startTime < resolution || last.count > 1)
+          {
+            if (it->startTime - last.endTime < resolution)
+            {
+              last.endTime = it->endTime;
+              last.count += it->count;
+              if (it->longestDuration > last.longestDuration)
+              {
+                last.longestDuration = it->longestDuration;
+                last.nameID = it->nameID;
+              }
+              merged = true;
+              continue;
+            }
+          }
+        }
+
+        dst.push_back(*it);
       }
+
+      singleSpans &= dst.size() <= 1;
     }
+
+    // Only keep levels that actually reduced the amount of spans
+    if (!merged)
+      continue;
+
+    info.lodLevels.push_back(std::move(lod));
+    prevSpans = &info.lodLevels.back().depthSpans;
+
+    if (singleSpans)
+      break;
   }
-	ImGui::EndChild();
-
-	ImGui::BeginChild("EventData", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
-	// Update cursor pos and item size
-	itemHeight = (ImGui::GetWindowFontSize() + ImGui::GetStyle().FramePadding.y * 2) * 0.6f;
-	lineheight = itemHeight * 1.2f;
-	cursorScreenPosStart.y += lineheight;
-	ImGui::SetCursorScreenPos(cursorScreenPosStart);
-	ImGui::EndChild();
-	
-	// update thread data positions
-	ImGui::BeginChild("ThreadData", ImVec2(ImGui::GetWindowSize().x * 0.15f, 0), false, ImGuiWindowFlags_NoScrollbar);
-	ImVec2 threadDataCursorPos = ImGui::GetCursorPos();
-	ImGui::SetCursorPos(ImVec2(threadDataCursorPos.x, threadDataCursorPos.y + lineheight));
-	ImGui::EndChild();
-
-	// Draw events for each thread
-	for (auto it = m_captureInfo.begin(); it != m_captureInfo.end(); it++)
-	{
-		ThreadEventInfo &info = *it;
-
-		ImGui::BeginChild("ThreadData", ImVec2(ImGui::GetWindowSize().x * 0.15f, 0), false, ImGuiWindowFlags_NoScrollbar);
-		ImGui::Text(info.threadName);
-		ImGui::SetCursorPos(ImVec2(threadDataCursorPos.x, ImGui::GetCursorPos().y + (lineheight * it->maxDepth)));
-		ImGui::EndChild();
-
-		// Render event data
-		ImGui::BeginChild("EventData", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
-		ImGui::Separator();
-
-		// TODO - clip event range (binary search)
-		for (auto evIt = info.events.begin(); evIt != info.events.end(); evIt++)
-		{
-			ProfilerEventManager::ProfilerEvent* ev = *evIt;
-
-			// Clip if event is out of visible range
-			if (ev->startTime + ev->duration < startTime + displayTimeStartActual)
-				continue;
-			if (ev->startTime > startTime + displayTimeStartActual + displayTimeVisibleActual)
-				break;
-
-			// Calculate start pos
-			float startP = (float)((float)ev->startTime - startTime) / displayTime;
-			ImVec2 eventPos((startP * totalProfileLength) + cursorScreenPosStart.x, cursorScreenPosStart.y + itemHeight * ev->depth);
-			// Calculate size
-			ImVec2 eventSize(((float)ev->duration / displayTime) * totalProfileLength, itemHeight);
-			ImVec2 eventEnd(eventPos.x + eventSize.x, eventPos.y + eventSize.y);
-
-			if (ImGui_ClipRect(eventPos, eventEnd, clipRectPos, clipRectEnd))
-			{
-				ImGui::GetWindowDrawList()->AddRectFilled(eventPos, eventEnd, ev->color);
-				if (ImGui_IsItemHovered(eventPos, eventEnd))
-				{
-					ImGui::BeginTooltip();
-					ImGui::Text("%s (%.2fms)", ev->name, ev->duration * (1.0f / 1e6));
-					ImGui::EndTooltip();
-				}
-			}
-		}
-		ImGui::EndChild();
-	}
-
-
-  ImGui::End(); // end profiler window
-}
\ No newline at end of file
+}
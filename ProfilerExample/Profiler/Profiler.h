@@ -1,114 +1,465 @@
 ﻿#ifndef _PROFILER_H
 #define _PROFILER_H
 
-#include <chrono>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <string>
 #include "MemoryPager.h"
+#include "NameRegistry.h"
+#include "RingBuffer.h"
+#include "StreamWriter.h"
+#include "TraceExport.h"
+#include "ScopeStats.h"
+#include "CallTree.h"
+#include "Sampler.h"
+#include "PerfCounters.h"
+#include "AllocationTracker.h"
 
 // Per-thread event manager
 class ProfilerEventManager
 {
 public:
-	// Single event data
-	struct ProfilerEvent
-	{
-		unsigned long long startTime;   // 8 -> 8
-		unsigned long long duration;    // 8 -> 16
-		uint32_t color;									// 4 -> 20
-		uint32_t depth;									// 4 -> 24
-		char name[64];									// 64 -> 88
-	};
-
-  ProfilerEventManager();
-  ~ProfilerEventManager() {}
-
-	ProfilerEventManager::ProfilerEvent* PushEvent(uint32_t color, const char* pFormat);
+  static const unsigned long long kOpenEventDuration = ~0ull; // duration of events that haven't ended yet
+  static const uint32_t kInvalidStreamIndex = 0xFFFFFFFF;
+
+  // How events are written into the history pages
+  enum RecordFormat
+  {
+    kRecordEvents = 0,  // ProfilerEvents with depth and duration, patched when the event ends
+    kRecordStream,      // StreamTokens for begin and end, nesting is reconstructed when capturing
+    kRecordCounters     // CountedEvents, falls back to kRecordEvents if the thread can't open hardware counters
+  };
+
+  // Single event data, written into the history page when the event starts and patched when it ends
+  struct ProfilerEvent
+  {
+    unsigned long long startTime;   // 8 -> 8
+    std::atomic<unsigned long long> duration; // 8 -> 16, patched while other threads may be reading the event
+    uint32_t nameID;                // 4 -> 20, see NameRegistry
+    uint32_t depth;                 // 4 -> 24
+  };
+
+  // ProfilerEvent extended with hardware counter deltas, see PerfCounters
+  struct CountedEvent
+  {
+    ProfilerEvent event;            // 24 -> 24, pointers to this are used like any other ProfilerEvent
+    unsigned long long counters[PerfCounters::kNumCounters]; // 32 -> 56, values at the start until they're replaced by the deltas, before the duration is patched
+  };
+
+  enum AllocType : uint32_t { kAlloc = 0, kFree };
+
+  // Allocation or free recorded by the AllocationTracker, kept in separate pages
+  struct AllocRecord
+  {
+    unsigned long long timestamp;   // 8 -> 8
+    uint64_t address;               // 8 -> 16
+    unsigned long long bytes;       // 8 -> 24, estimated bytes this record stands for when allocations are sampled
+    long long liveBytes;            // 8 -> 32, estimated live heap of all threads after this record
+    uint32_t nameID;                // 4 -> 36, innermost open event, NameRegistry::kInvalidNameID outside of events
+    uint32_t type;                  // 4 -> 40, AllocType
+  };
+
+  enum LockEventType : uint32_t { kLockWait = 0, kLockAcquired, kLockReleased };
+
+  // Lock contention recorded by the ProfiledMutex wrappers, kept in separate pages
+  struct LockRecord
+  {
+    unsigned long long timestamp;   // 8 -> 8, when the wait started, the lock was acquired or released
+    unsigned long long startTime;   // 8 -> 16, start of the wait for kLockAcquired, start of the hold for kLockReleased
+    uint64_t lockID;                // 8 -> 24, address of the mutex
+    uint32_t nameID;                // 4 -> 28, name of the mutex
+    uint32_t type;                  // 4 -> 32, LockEventType
+    uint32_t holderThreadID;        // 4 -> 36, kLockWait: exclusive holder when the wait started, 0 if unknown
+    uint32_t shared;                // 4 -> 40, 1 for shared locks
+  };
+
+  enum TokenType : uint32_t { kTokenBegin = 0, kTokenEnd };
+
+  // Begin / end marker used by the stream format
+  struct StreamToken
+  {
+    unsigned long long timestamp;   // 8 -> 8
+    uint32_t nameID;                // 4 -> 12, unused for end tokens
+    uint32_t type : 1;              // TokenType
+    uint32_t depth : 31;            // 4 -> 16, of the event that begins or ends, so ends still match once outer begins expired
+  };
+
+  static const uint32_t kMaxSampleFrames = 30;
+
+  // Stack trace taken by the Sampler, kept in separate pages
+  struct Sample
+  {
+    unsigned long long timestamp;   // 8 -> 8
+    uint32_t numFrames;             // 4 -> 12
+    uint32_t pad;                   // 4 -> 16
+    uint64_t frames[kMaxSampleFrames]; // 240 -> 256, return addresses, the interrupted one first
+  };
+
+  ProfilerEventManager(RecordFormat format);
+  ~ProfilerEventManager();
+
+  void PushEvent(uint32_t nameID);
   void PopEvent();
+  // Ends the events that are still open at the current time, so their records don't stay open forever
+  void EndOpenEvents();
+
+  MemoryPager::PageList &GetPages() { return m_pages; }
+  RecordFormat GetFormat() { return m_format; }
+  uint32_t GetRecordSize() { return GetRecordSize(m_format); }
+  static uint32_t GetRecordSize(RecordFormat format) { return format == kRecordStream ? sizeof(StreamToken) : format == kRecordCounters ? sizeof(CountedEvent) : sizeof(ProfilerEvent); }
+
+  // Check if a record can be expired, records that are still being written to never are
+  bool IsRecordOutdated(const int8_t* record, unsigned long long cutoffTime);
+
+  // Called from the Sampler's signal handler on the owning thread, so it never allocates. Samples are dropped
+  // when the spare page the frame thread sets aside is used up
+  void AddSample(unsigned long long timestamp, const uint64_t* frames, uint32_t numFrames);
+  MemoryPager::PageList &GetSamplePages() { return m_samplePages; }
+  uint32_t GetDroppedSamples() { return m_droppedSamples.load(std::memory_order_relaxed); }
+  const Sampler::ThreadState &GetSamplerState() { return m_samplerState; }
 
-  std::vector<MemoryPager::Page*> &GetPages() { return m_pages; }
+  // Called by the AllocationTracker on the owning thread
+  void AddAllocation(AllocType type, uint64_t address, unsigned long long bytes, long long liveBytes);
+  MemoryPager::PageList &GetAllocPages() { return m_allocPages; }
+
+  // Called by the ProfiledMutex wrappers on the owning thread
+  void AddLockRecord(LockEventType type, const void* lock, uint32_t nameID, unsigned long long startTime, unsigned long long timestamp, uint32_t holderThreadID, bool shared);
+  MemoryPager::PageList &GetLockPages() { return m_lockPages; }
 
   uint32_t GetThreadID() { return m_threadID; }
   const char* GetThreadName() { return m_threadName; }
 
+  // Called when the owning thread exits, the profiler deletes the manager once all its pages expired.
+  // The thread can't reach the manager anymore at that point, so nothing gets added after this
+  void Retire() { m_retired.store(true, std::memory_order_release); }
+  bool IsRetired() { return m_retired.load(std::memory_order_acquire); }
+
+  ProfilerEventManager* GetNext() { return m_nextManager; }
+
 private:
+  friend class Profiler;
+  friend class Sampler;
+  friend class AllocationTracker;
+
+  // Returns space for a record at the end of the history, moving to a new page if needed
+  // The record becomes visible to other threads once it's committed
+  int8_t* ReserveRecord(uint32_t size);
+  void CommitRecord(uint32_t size);
+
+  RecordFormat m_format;
   MemoryPager::Page* m_currentPage;
-  MemoryPager::Page* m_stackPage;
-  uint32_t m_eventDepth;
-  
-  std::vector<MemoryPager::Page*> m_pages;
-  std::vector<MemoryPager::Page*> m_stackPages;
-  std::vector<ProfilerEvent*> m_eventStack;
+
+  MemoryPager::PageList m_pages;
+  std::vector<ProfilerEvent*> m_eventStack; // open events, pointing into m_pages. Unused by the stream format
+  std::vector<uint32_t> m_nameStack; // name IDs of the open events, only used by the stream format
+  PerfCounters m_counters; // only opened for the counter format
 
   // Thread info
   char m_threadName[64];
   uint32_t m_threadID;
+
+  // Registry info, the profiler keeps managers in an append-only linked list
+  ProfilerEventManager* m_nextManager;
+  std::atomic<bool> m_retired;
+
+  uint32_t m_streamIndex; // thread index in the stream file, only used by the frame thread
+
+  // Sampling
+  MemoryPager::PageList m_samplePages;
+  MemoryPager::Page* m_currentSamplePage;             // only used by the signal handler
+  std::atomic<MemoryPager::Page*> m_spareSamplePage;  // refilled by the frame thread
+  std::atomic<uint32_t> m_droppedSamples;
+  Sampler::ThreadState m_samplerState;
+
+  // Allocation tracking
+  MemoryPager::PageList m_allocPages;
+  MemoryPager::Page* m_currentAllocPage;
+  long long m_allocCountdown; // bytes until the next sampled allocation
+  uint64_t m_allocRandom;     // xorshift state for the sampling distances
+
+  // Lock contention
+  MemoryPager::PageList m_lockPages;
+  MemoryPager::Page* m_currentLockPage;
 };
 
 // Profiler class
 class Profiler
 {
 public:
-  static const unsigned long long kMaxProfileTime = (unsigned long long)(10e9); // 10 second buffer
+  static const unsigned long long kMaxProfileTime = (unsigned long long)(10e9); // 10 second buffer, in ns
+  static const unsigned long long kMinFrameTime = (unsigned long long)(1e6);    // 1 ms, faster frames shorten the frame history
+  static const uint32_t kMaxFrames = (uint32_t)(kMaxProfileTime / kMinFrameTime);
   struct FrameTime
   {
-		unsigned long long startTime;
-		unsigned long long duration;
-		int32_t color;
+    unsigned long long startTime;
+    unsigned long long duration;
+    int32_t color;
   };
 
   static Profiler* Get() { return &s_profiler; }
 
-  // return the current threads event manager
+  // return the current threads event manager, null once the thread is exiting and its manager got retired
   ProfilerEventManager* GetEventManager();
-  
-  ProfilerEventManager::ProfilerEvent* BeginEvent(uint32_t color, const char* aName);
+  // Same, but null if the thread doesn't have one yet. Safe to call from signal handlers
+  static ProfilerEventManager* GetCurrentEventManager();
+  // Threads with an event manager, including exited ones whose events didn't expire yet
+  uint32_t GetNumManagers() { return m_numManagers.load(std::memory_order_relaxed); }
+
+  void BeginEvent(uint32_t nameID);
+  void BeginEvent(uint32_t color, const char* aName);
   void EndEvent();
 
+  // Format used by event managers created after this call, set it before any events are recorded.
+  // kRecordCounters opts the threads that start afterwards into hardware counters
+  void SetRecordFormat(ProfilerEventManager::RecordFormat format) { m_recordFormat = format; }
+
   void BeginFrame();
   void EndFrame();
 
+  // How long recorded events are kept around for captures, in ns. Clamped to kMaxProfileTime, shorter histories use less memory.
+  // Events that are still open never expire, so in kRecordEvents a long running scope (a thread's main loop, say) keeps the
+  // page holding its record, up to MemoryPager::kPageSize per thread, past the history time. Stream tokens expire regardless
+  void SetHistoryTime(unsigned long long ns);
+  unsigned long long GetHistoryTime() { return m_historyTime; }
+
+  // Snapshot the recorded events of all threads into the current capture, call it from the thread running the frames.
+  // Without waiting it returns right away and Render shows the capture once the capture thread built it
+  void TakeCapture(bool wait = true);
+
+  // Save the current capture to a file, or replace it with a capture loaded from one (see CaptureFile.h)
+  bool SaveCapture(const char* path);
+  bool LoadCapture(const char* path);
+
+  // Write the current capture in a format other tools can open
+  bool ExportTrace(const char* path, TraceWriter::Format format);
+
+  // Continuously write recorded events to a capture file, pages are written as soon as they're full.
+  // Stop streaming or call Shutdown before main returns, otherwise it's stopped from atexit
+  bool StartStreaming(const char* path);
+  void StopStreaming();
+  bool IsStreaming() { return m_streamWriter.IsRunning(); }
+
+  // Periodically sample the stacks of all threads with an event manager, shown as ticks under each thread (see Sampler.h)
+  bool StartSampling(uint32_t frequency = Sampler::kDefaultFrequency);
+  void StopSampling();
+  bool IsSampling() { return m_sampler.IsRunning(); }
+
+  // Stops streaming (writing out what's recorded so far), sampling and the capture thread. They use the pager and
+  // name registry, which are statics in other files, so this has to run before static destruction. Starting any of
+  // them registers Shutdown with atexit, the destructor doesn't flush anything
+  void Shutdown();
+
+  // ImGui front end, implemented in ProfilerRender.cpp so headless builds can leave it out
   void Render();
-	void UpdateZoom();
+  void UpdateZoom();
 
 private:
   Profiler();
   ~Profiler();
 
+  // Registered once, handlers registered after the statics were constructed run before they're destroyed
+  void RegisterShutdown();
+  static void ShutdownAtExit() { s_profiler.Shutdown(); }
+
   void ClearOutdatedEvents();
+  // Starts the capture thread on a snapshot of the managers' pages, unless it's already running
   void GetCurrentCapture();
 
   static Profiler s_profiler;
 
+  // Level of detail settings for zoomed out rendering
+  static const unsigned long long kLodBaseResolution = 1000; // resolution of the first level, in ns
+  static const uint32_t kLodLevelScale = 4;                  // resolution multiplier per level
+  static const uint32_t kMaxLodLevels = 12;
+
+  // Capture file values above these are treated as corrupt
+  static const uint32_t kMaxLoadedThreads = 4096;
+  static const uint32_t kMaxLoadedDepth = 1024;
+  static const uint32_t kMaxLoadedNames = NameRegistry::kChunkSize * NameRegistry::kMaxChunks; // a saved registry can't hold more
+
+  // Run of events on one depth, merged because they'd be smaller than a pixel
+  struct EventSpan
+  {
+    unsigned long long startTime;
+    unsigned long long endTime;
+    unsigned long long longestDuration;
+    uint32_t nameID;  // name of the longest event in the span
+    uint32_t count;   // number of events merged into this span
+  };
+
+  struct LodLevel
+  {
+    unsigned long long resolution; // in ticks, spans shorter than this got merged with neighbours closer than this
+    std::vector<std::vector<EventSpan>> depthSpans; // spans per depth, sorted by start and end time
+  };
+
+  // Part of a page taken into a capture
+  struct PageRange
+  {
+    MemoryPager::Page* page;
+    uint32_t readOffset;
+    uint32_t writeOffset;
+  };
+
+  // Wait for a lock, or a hold of a lock another thread waited for
+  struct LockSegment
+  {
+    unsigned long long startTime;
+    unsigned long long endTime;
+    uint64_t lockID;
+    uint32_t nameID;
+    uint32_t holderThreadID; // waits only, 0 if unknown
+    bool shared;
+  };
+
   struct ThreadEventInfo
   {
     char threadName[64];
     uint32_t threadID;
     uint32_t maxDepth; // max event depth for this thread
+    ProfilerEventManager::RecordFormat format;
 
-    std::vector<MemoryPager::Page*> pages;
-    std::vector<ProfilerEventManager::ProfilerEvent*> events;
+    std::vector<MemoryPager::Page*> pages;  // pages this capture holds a reference to
+    std::vector<PageRange> pageRanges;      // recorded data at the time of the capture
+    std::vector<ProfilerEventManager::ProfilerEvent*> events; // sorted by start time
+    std::vector<std::vector<ProfilerEventManager::ProfilerEvent*>> depthEvents; // events per depth, sorted by start and end time
+    std::vector<LodLevel> lodLevels; // increasingly coarse versions of depthEvents
+
+    std::vector<PageRange> samplePageRanges;
+    std::vector<const ProfilerEventManager::Sample*> samples; // sorted by time, pointing into pages
+
+    std::vector<PageRange> allocPageRanges;
+    std::vector<const ProfilerEventManager::AllocRecord*> allocations; // sorted by time, pointing into pages
+
+    std::vector<PageRange> lockPageRanges;
+    std::vector<LockSegment> lockWaits; // sorted by start time
+    std::vector<LockSegment> lockHolds; // holds other threads waited on, sorted by end time
+    unsigned long long longestLockHold;
+  };
+
+  // Estimated live heap after an allocation or free
+  struct HeapPoint
+  {
+    unsigned long long timestamp;
+    long long liveBytes;
   };
 
-  std::vector<FrameTime> m_frameTimes;
-  std::vector<ProfilerEventManager*> m_managers;
+  // Everything Render needs to display a capture
+  struct Capture
+  {
+    Capture() : numEvents(0), captureTime(0), statsSortColumn(-1), statsSortDescending(false), callTreeFocus(CallTreeNode::kRoot), maxLiveBytes(0) { longestFrame.startTime = longestFrame.duration = 0; longestFrame.color = 0; }
+
+    std::vector<ThreadEventInfo> threads;
+    std::vector<FrameTime> frameTimes; // sorted by start time
+    uint32_t numEvents;
+    unsigned long long captureTime;
+    FrameTime longestFrame;
+    std::string fileName; // file the capture was loaded from, empty for live captures
+
+    std::vector<ScopeStats> scopeStats; // per name, over all threads
+    int statsSortColumn;                // order scopeStats is currently sorted in, -1 if unsorted
+    bool statsSortDescending;
+
+    std::vector<CallTreeNode> callTree; // events of all threads merged by name path
+    uint32_t callTreeFocus;             // node the flame graph is zoomed into
+
+    std::vector<HeapPoint> heapTimeline; // allocations and frees of all threads, sorted by time
+    long long maxLiveBytes;
+  };
+
+  // Runs on the capture thread, extracts the events from the pages snapshotted by GetCurrentCapture
+  void BuildCapture(Capture* capture);
+
+  // Build the per depth and level of detail data once all events of a capture are known
+  void FinishCapture(Capture* capture);
+
+  // Swap in the capture once the capture thread is done with it
+  void UpdateCapture();
+  void ReleaseCapture(Capture* capture);
+
+  // Queue the records of a page that weren't streamed yet, only called from the frame thread
+  void StreamPage(ProfilerEventManager* mngr, MemoryPager::Page* page, uint32_t writeOffset);
+
+  // Remove a retired manager from the list, prev is the manager before it when known. Only called from the frame thread
+  void UnregisterManager(ProfilerEventManager* mngr, ProfilerEventManager* prev);
+
+  // Take a reference to a manager's full pages and copy its partially filled tail page
+  void SnapshotPages(ProfilerEventManager* mngr, ThreadEventInfo &info);
+  void SnapshotPageList(MemoryPager::PageList &pages, ThreadEventInfo &info, std::vector<PageRange> &ranges);
+
+  // Extract the events from a thread's page ranges, depending on the record format
+  void CaptureEventPages(ThreadEventInfo &info);
+  void CaptureStreamPages(ThreadEventInfo &info);
+  void CaptureSamplePages(ThreadEventInfo &info);
+  void CaptureAllocPages(ThreadEventInfo &info);
+  void CaptureLockPages(ThreadEventInfo &info, unsigned long long captureTime);
+
+  // Expire records of a page list that start with their timestamp and are written in time order
+  void ClearOutdatedRecords(MemoryPager::PageList &pages, uint32_t recordSize, unsigned long long cutoffTime, bool retired);
+
+  // Add an event to a capture, stored in pages owned by the capture
+  ProfilerEventManager::ProfilerEvent* AddCaptureEvent(ThreadEventInfo &info, MemoryPager::Page*& eventPage, unsigned long long startTime, unsigned long long duration, uint32_t nameID, uint32_t depth);
+  void BuildLodLevels(ThreadEventInfo &info);
+  void BuildScopeStats(Capture* capture);
+  void BuildCallTree(Capture* capture);
+  void BuildHeapTimeline(Capture* capture);
+
+  // Statistics table next to the timeline, part of the ImGui front end
+  void RenderScopeStats(Capture* capture);
+
+  // Flame graph and call tree window, part of the ImGui front end
+  void RenderCallTree(Capture* capture);
+  void RenderFlameGraph(Capture* capture);
+  void RenderCallTreeNode(Capture* capture, uint32_t nodeIndex);
+
+  RingBuffer<FrameTime> m_frameTimes;
+  std::atomic<ProfilerEventManager*> m_managers; // lock-free list, threads push their manager at the front
+  std::atomic<uint32_t> m_numManagers;
+  ProfilerEventManager::RecordFormat m_recordFormat;
   bool m_isOpen;
 
   // Capture info
-  std::vector<ThreadEventInfo> m_captureInfo;
-  std::vector<FrameTime> m_captureFrameTimes;
-  uint32_t m_numEventsInCapture;
-  unsigned long long m_captureTime;
-  FrameTime m_longestFrame;
+  std::unique_ptr<Capture> m_capture;       // capture being displayed
+  std::thread m_captureThread;              // builds the next capture
+  std::atomic<Capture*> m_finishedCapture;  // set by the capture thread when it's done
+  std::atomic<uint32_t> m_captureProgress;  // page ranges processed by the capture thread
+  uint32_t m_captureProgressTotal;
+
+  // Streaming
+  StreamWriter m_streamWriter;
+  uint32_t m_numStreamedThreads;
+
+  // Sampling
+  Sampler m_sampler;
+  int m_samplingFrequency; // set in the UI, in Hz
+
+  // Statistics UI
+  bool m_showScopeStats;
+  int m_statsSortColumn;
+  bool m_statsSortDescending;
+
+  // Call tree UI
+  bool m_showCallTree;
+  bool m_callTreeAsFlameGraph; // flame graph or expandable tree
+
+  // Capture file UI
+  char m_captureFilePath[256];
+  const char* m_captureFileError; // result of the last save or load, null if it succeeded
+  bool m_shutdownRegistered;
 
   // Profiler type data
   int m_precedingFrameTime;
   int m_procedingFrameTime;
   int m_lastXAmountOfTime;
 
-	float m_framesPerSecond;
-	float m_zoom;
+  float m_framesPerSecond;
+  float m_zoom;
 
-	// Frame timer helpers
-	std::chrono::high_resolution_clock::time_point m_frameStart;
+  // Frame timer helpers, in timer ticks
+  unsigned long long m_frameStart;
+  unsigned long long m_historyTime; // in ns
 };
 
 #endif
@@ -0,0 +1,917 @@
+﻿#include <string>
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+#include "Profiler.h"
+#include "imgui/imgui.h"
+#include "ImGuiExtended.h"
+#include "Timer.h"
+#include "NameRegistry.h"
+#include "TimedEvent.h"
+
+// ImGui front end of the profiler, the recording core builds without it
+
+static std::string BytesToSize(float bytes)
+{
+  static const float tb = 1099511627776;
+  static const float gb = 1073741824;
+  static const float mb = 1048576;
+  static const float kb = 1024;
+
+  char temp[1024] = {};
+
+  if (bytes >= tb)
+    snprintf(temp, sizeof(temp), "%.2f TB", (float)bytes * (1.0f / tb));
+  else if (bytes >= gb)
+    snprintf(temp, sizeof(temp), "%.2f GB", (float)bytes * (1.0f / gb));
+  else if (bytes >= mb)
+    snprintf(temp, sizeof(temp), "%.2f MB", (float)bytes * (1.0f / mb));
+  else if (bytes >= kb)
+    snprintf(temp, sizeof(temp), "%.2f KB", (float)bytes * (1.0f / kb));
+  else
+    snprintf(temp, sizeof(temp), "%.2f B", bytes);
+
+  std::string returnSize(temp);
+  return returnSize;
+}
+
+void Profiler::UpdateZoom()
+{
+	// TODO - update scroll position based on scroll amount
+	if (ImGui::GetIO().MouseWheel)
+	{
+		m_zoom += ImGui::GetIO().MouseWheel * 10.0f;
+		m_zoom = std::fmax(std::fmin(m_zoom, 1000.0f), 0.0f);
+	}
+}
+
+void Profiler::Render()
+{
+	UpdateCapture();
+	UpdateZoom();
+	Capture* capture = m_capture.get();
+  ImGuiIO io = ImGui::GetIO();
+
+  ImGui::SetNextWindowPos(ImVec2(io.DisplaySize.x * 0.1f, io.DisplaySize.y * 0.1f), ImGuiSetCond_Once);
+  ImGui::SetNextWindowSize(ImVec2(io.DisplaySize.x * 0.8f, io.DisplaySize.y * 0.8f), ImGuiSetCond_Once);
+
+  ImGui::Begin("Profiler", &m_isOpen);
+
+  // Capture button
+  ImGui::PushItemWidth(ImGui::GetWindowSize().x * 0.1f);
+  if (ImGui::Button("Show Capture"))
+  {
+    TakeCapture(false);
+  }
+  ImGui::PopItemWidth();
+
+  // Turning recording off makes events skip the profiler entirely
+  ImGui::SameLine();
+  bool captureEnabled = TimedEvent::IsCaptureEnabled();
+  if (ImGui::Checkbox("Record Events", &captureEnabled))
+    TimedEvent::SetCaptureEnabled(captureEnabled);
+
+  ImGui::SameLine();
+  ImGui::Checkbox("Statistics", &m_showScopeStats);
+  ImGui::SameLine();
+  ImGui::Checkbox("Call Tree", &m_showCallTree);
+
+  // Sampling, the frequency applies the next time it's turned on
+  if (Sampler::IsSupported())
+  {
+    ImGui::SameLine();
+    bool sampling = IsSampling();
+    if (ImGui::Checkbox("Sample", &sampling))
+    {
+      if (sampling)
+        StartSampling((uint32_t)m_samplingFrequency);
+      else
+        StopSampling();
+    }
+    ImGui::SameLine();
+    ImGui::PushItemWidth(ImGui::GetWindowSize().x * 0.05f);
+    if (ImGui::InputInt("Hz", &m_samplingFrequency, 0))
+      m_samplingFrequency = std::max(1, std::min(m_samplingFrequency, (int)Sampler::kMaxFrequency));
+    ImGui::PopItemWidth();
+  }
+
+  // Only records anything once the application's allocator calls the AllocationTracker
+  ImGui::SameLine();
+  bool trackAllocations = AllocationTracker::Get()->IsEnabled();
+  if (ImGui::Checkbox("Allocations", &trackAllocations))
+  {
+    if (trackAllocations)
+      AllocationTracker::Get()->Enable();
+    else
+      AllocationTracker::Get()->Disable();
+  }
+
+  // Capture file
+  ImGui::SameLine();
+  ImGui::PushItemWidth(ImGui::GetWindowSize().x * 0.15f);
+  ImGui::InputText("##CaptureFile", m_captureFilePath, sizeof(m_captureFilePath));
+  ImGui::PopItemWidth();
+  ImGui::SameLine();
+  if (ImGui::Button("Save"))
+    m_captureFileError = SaveCapture(m_captureFilePath) ? nullptr : "Failed to save capture";
+  ImGui::SameLine();
+  if (ImGui::Button("Load"))
+  {
+    m_captureFileError = LoadCapture(m_captureFilePath) ? nullptr : "Failed to load capture";
+    capture = m_capture.get();
+  }
+  ImGui::SameLine();
+  if (!IsStreaming())
+  {
+    if (ImGui::Button("Stream"))
+      m_captureFileError = StartStreaming(m_captureFilePath) ? nullptr : "Failed to start streaming";
+  }
+  else if (ImGui::Button("Stop Streaming"))
+    StopStreaming();
+  ImGui::SameLine();
+  if (ImGui::Button("Export JSON"))
+    m_captureFileError = ExportTrace((std::string(m_captureFilePath) + ".json").c_str(), TraceWriter::kChromeJson) ? nullptr : "Failed to export trace";
+  ImGui::SameLine();
+  if (ImGui::Button("Export Perfetto"))
+    m_captureFileError = ExportTrace((std::string(m_captureFilePath) + ".perfetto-trace").c_str(), TraceWriter::kPerfetto) ? nullptr : "Failed to export trace";
+  if (m_captureFileError != nullptr)
+  {
+    ImGui::SameLine();
+    ImGui::Text("%s", m_captureFileError);
+  }
+
+  // Show progress while the next capture is being built
+  if (m_captureThread.joinable())
+  {
+    ImGui::SameLine();
+    float progress = m_captureProgressTotal > 0 ? (float)m_captureProgress.load(std::memory_order_relaxed) / m_captureProgressTotal : 0.0f;
+    ImGui::ProgressBar(progress, ImVec2(ImGui::GetWindowSize().x * 0.1f, 0), "Capturing");
+  }
+
+  ImGui::SameLine();
+
+  ImGui::PushItemWidth(ImGui::GetWindowSize().x * 0.25f);
+  enum ProfilerType : int { kShowLongestFrame = 0, kLongestFrameWithMargin, kLastXMilliseconds };
+  const char* comboItems[] = { "Show Longest Frame", "Show Longest Frame with Margin", "Show Last X Amount of Time" };
+  static int type = kLastXMilliseconds;
+  ImGui::Combo("Profile Mode", &type, comboItems, 3);
+  ImGui::PopItemWidth();
+
+  // Render profiler type data
+  if (type == kLongestFrameWithMargin)
+  {
+    ImGui::PushItemWidth(ImGui::GetWindowSize().x * 0.1f);
+    ImGui::SameLine();
+    ImGui::InputInt("Preceding frame time", &m_precedingFrameTime);
+    ImGui::SameLine();
+    ImGui::InputInt("Proceding frame time", &m_procedingFrameTime);
+    ImGui::PopItemWidth();
+  }
+  else if (type == kLastXMilliseconds)
+  {
+    ImGui::PushItemWidth(ImGui::GetWindowSize().x * 0.1f);
+    ImGui::SameLine();
+    ImGui::InputInt("Time in MS", &m_lastXAmountOfTime);
+    ImGui::PopItemWidth();
+  }
+
+  ImGui::Text("Showing %u events for %u threads, %u Pages created, total mem: %s", capture->numEvents, m_numManagers.load(std::memory_order_relaxed), MemoryPager::Get()->GetNumPages(), BytesToSize((float)MemoryPager::Get()->GetNumPages() * MemoryPager::kPageSize).c_str());
+	ImGui::Text("FPS: %.2f", m_framesPerSecond);
+  if (!capture->fileName.empty())
+  {
+    ImGui::SameLine();
+    ImGui::Text("Loaded from %s", capture->fileName.c_str());
+  }
+  if (IsStreaming())
+  {
+    ImGui::SameLine();
+    ImGui::Text("Streaming to %s, %s written, %u pages queued", m_streamWriter.GetPath(), BytesToSize((float)m_streamWriter.GetBytesWritten()).c_str(), m_streamWriter.GetQueuedPages());
+  }
+
+  // Setup some information we need to help display
+  unsigned long long startTime = 0;
+	unsigned long long displayTime = 0; // total time we will display for this frame
+	uint32_t displayTimeMS = 0;
+	unsigned long long ticksPerMS = Timer::NsToTicks(1e6); // all times are in timer ticks
+  switch (type)
+  {
+  case kShowLongestFrame:
+    startTime = capture->longestFrame.startTime;
+    displayTime = capture->longestFrame.duration;
+    break;
+  case kLongestFrameWithMargin:
+    startTime = capture->longestFrame.startTime - Timer::NsToTicks(m_precedingFrameTime);
+    displayTime = Timer::NsToTicks(m_precedingFrameTime) + capture->longestFrame.duration + Timer::NsToTicks(m_procedingFrameTime);
+    break;
+  case kLastXMilliseconds:
+    startTime = capture->captureTime - (m_lastXAmountOfTime * ticksPerMS);
+    displayTime = (m_lastXAmountOfTime * ticksPerMS);
+		displayTimeMS = m_lastXAmountOfTime;
+    break;
+  }
+	  
+  // Create profiler layout, will be filled with data later. The statistics table takes the right side of the window
+  ImVec2 eventDataSize(m_showScopeStats ? -ImGui::GetWindowSize().x * 0.4f : 0.0f, 0.0f);
+  ImGui::BeginChild("ThreadData", ImVec2(ImGui::GetWindowSize().x * 0.15f, 0), false, ImGuiWindowFlags_NoScrollbar);
+	ImGui::Text("Frame times");
+  ImGui::EndChild();
+
+  ImGui::SameLine();
+
+  ImGui::BeginChild("EventData", eventDataSize, false, ImGuiWindowFlags_HorizontalScrollbar);
+
+  // Calculate clip rect
+  ImVec2 clipRectPos(ImGui::GetWindowPos());
+  ImVec2 clipRectSize(ImGui::GetWindowSize());
+  ImVec2 clipRectEnd(clipRectPos.x + clipRectSize.x, clipRectPos.y + clipRectSize.y);
+
+  // Start by drawing the timeline
+  // Store current cursor pos
+  ImVec2 cursorScreenPosStart = ImGui::GetCursorScreenPos();
+
+  // Calculate how big each MS will be displayed
+  float step = 20 + (m_zoom * 0.2f);
+  ImGui::SetCursorScreenPos(ImVec2(cursorScreenPosStart.x, ImGui::GetWindowPos().y));
+	
+	// Set the event window size
+	ImVec2 curPosStart = ImGui::GetCursorScreenPos();
+	ImGui::SetCursorScreenPos(ImVec2(curPosStart.x + (step * displayTimeMS), ImGui::GetWindowPos().y));
+	ImGui::SetCursorScreenPos(ImVec2(curPosStart.x, ImGui::GetWindowPos().y));
+	
+	// calculate visibility
+	uint32_t displayTimeStart = (int)(ImGui::GetScrollX() / step); // round down
+	uint32_t displayTimeEnd = std::fmin((int)(displayTimeStart + ImGui::GetWindowSize().x / step) + 2, displayTimeMS); // round up;
+	uint32_t displayTimeVisible = displayTimeEnd - displayTimeStart;
+
+	unsigned long long displayTimeStartActual = displayTimeStart * ticksPerMS;
+	unsigned long long displayTimeVisibleActual = displayTimeVisible * ticksPerMS;
+
+	// Set cursorpos to first visible ms
+	ImGui::SetCursorScreenPos(ImVec2(curPosStart.x + (step * displayTimeStart), ImGui::GetWindowPos().y));
+  for (uint32_t i = displayTimeStart; i < displayTimeEnd; i++)
+  {
+    ImVec2 curPos = ImGui::GetCursorScreenPos();
+    ImGui::Text("%i", i);
+    if ((i % 2) == 0)
+      ImGui::GetWindowDrawList()->AddRectFilled(curPos, ImVec2(curPos.x + step, curPos.y + ImGui::GetWindowSize().y), IM_COL32(50, 50, 50, 200));
+	
+    ImGui::SetCursorScreenPos(ImVec2(curPos.x + step, ImGui::GetWindowPos().y));
+  }
+  cursorScreenPosStart.y += ImGui::GetTextLineHeight();
+  ImVec2 cursorScreenPosEnd = ImVec2(cursorScreenPosStart.x + (step * displayTimeMS), cursorScreenPosStart.y);
+
+  ImGui::SetCursorScreenPos(cursorScreenPosStart);
+
+  ImGui::EndChild();
+
+  if (m_showScopeStats)
+  {
+    ImGui::SameLine();
+    ImGui::BeginChild("ScopeStats", ImVec2(0, 0), true);
+    RenderScopeStats(capture);
+    ImGui::EndChild();
+  }
+  
+  // Draw frame times
+  ImGui::BeginChild("EventData", eventDataSize, false, ImGuiWindowFlags_HorizontalScrollbar);
+
+	// Calculate default item height we'll be using
+	float itemHeight = (ImGui::GetWindowFontSize() + ImGui::GetStyle().FramePadding.y * 2) * 0.35f;
+	float lineheight = itemHeight * 1.2f;
+	float totalProfileLength = (float)(cursorScreenPosEnd.x - cursorScreenPosStart.x);
+
+  // Find the first frame that ends inside the visible range
+  auto frameEndsBefore = [](const FrameTime& frame, unsigned long long time) { return frame.startTime + frame.duration < time; };
+  auto firstFrame = std::lower_bound(capture->frameTimes.begin(), capture->frameTimes.end(), startTime + displayTimeStartActual, frameEndsBefore);
+
+  for (auto it = firstFrame; it != capture->frameTimes.end(); it++)
+  {
+		if (it->startTime > startTime + displayTimeStartActual + displayTimeVisibleActual)
+			break;
+
+    // Frame is atleast partially inside the time we're displaying, so render it
+    // Calculate start pos
+    float startP = (float)((float)it->startTime - startTime) / displayTime;
+    ImVec2 framePos((startP * totalProfileLength) + cursorScreenPosStart.x, cursorScreenPosStart.y);
+    // Calculate size
+    ImVec2 frameSize(((float)it->duration / displayTime) * totalProfileLength, itemHeight);
+    ImVec2 frameEnd(framePos.x + frameSize.x, framePos.y + frameSize.y);
+
+    if (ImGui_ClipRect(framePos, frameEnd, clipRectPos, clipRectEnd))
+    {
+      ImGui::GetWindowDrawList()->AddRectFilled(framePos, frameEnd, it->color);
+      if (ImGui_IsItemHovered(framePos, frameEnd))
+      {
+        ImGui::BeginTooltip();
+        ImGui::Text("Frame time: %.2fms", Timer::TicksToNs(it->duration) * (1.0f / 1e6));
+        ImGui::EndTooltip();
+      }
+    }
+  }
+	ImGui::EndChild();
+
+	ImGui::BeginChild("EventData", eventDataSize, false, ImGuiWindowFlags_HorizontalScrollbar);
+	// Update cursor pos and item size
+	itemHeight = (ImGui::GetWindowFontSize() + ImGui::GetStyle().FramePadding.y * 2) * 0.6f;
+	lineheight = itemHeight * 1.2f;
+	cursorScreenPosStart.y += lineheight;
+
+	// Memory lane, the estimated live heap as a step graph scaled to the capture's maximum
+	float heapLaneHeight = capture->heapTimeline.empty() ? 0.0f : itemHeight * 3.0f + lineheight * 0.5f;
+	if (!capture->heapTimeline.empty())
+	{
+		unsigned long long visibleStart = startTime + displayTimeStartActual;
+		unsigned long long visibleEnd = startTime + displayTimeStartActual + displayTimeVisibleActual;
+		float heapBottom = cursorScreenPosStart.y + itemHeight * 3.0f;
+		float heapScale = capture->maxLiveBytes > 0 ? itemHeight * 3.0f / capture->maxLiveBytes : 0.0f;
+		std::vector<HeapPoint> &timeline = capture->heapTimeline;
+
+		// Start with the step that's current at the left edge
+		auto takenBefore = [](const HeapPoint& point, unsigned long long time) { return point.timestamp < time; };
+		auto pointIt = std::lower_bound(timeline.begin(), timeline.end(), visibleStart, takenBefore);
+		if (pointIt != timeline.begin())
+			pointIt--;
+
+		// Steps narrower than a pixel are merged into one column showing their highest value
+		float columnX = -1.0f;
+		float columnTop = heapBottom;
+		auto drawColumn = [&]()
+		{
+			ImVec2 columnPos(columnX, columnTop);
+			ImVec2 columnEnd(columnX + 1.0f, heapBottom);
+			if (columnX >= 0.0f && ImGui_ClipRect(columnPos, columnEnd, clipRectPos, clipRectEnd))
+				ImGui::GetWindowDrawList()->AddRectFilled(columnPos, columnEnd, IM_COL32(90, 160, 220, 255));
+		};
+
+		for (; pointIt != timeline.end() && pointIt->timestamp <= visibleEnd; pointIt++)
+		{
+			unsigned long long stepEnd = pointIt + 1 != timeline.end() ? (pointIt + 1)->timestamp : std::min(visibleEnd, capture->captureTime);
+			float stepStartP = (float)((float)pointIt->timestamp - startTime) / displayTime;
+			float stepEndP = (float)((float)stepEnd - startTime) / displayTime;
+			ImVec2 stepPos((stepStartP * totalProfileLength) + cursorScreenPosStart.x, heapBottom - (float)std::max(pointIt->liveBytes, 0ll) * heapScale);
+			ImVec2 stepEndPos((stepEndP * totalProfileLength) + cursorScreenPosStart.x, heapBottom);
+
+			if (stepEndPos.x - stepPos.x >= 1.0f)
+			{
+				drawColumn();
+				columnX = -1.0f;
+				if (ImGui_ClipRect(stepPos, stepEndPos, clipRectPos, clipRectEnd))
+					ImGui::GetWindowDrawList()->AddRectFilled(stepPos, stepEndPos, IM_COL32(90, 160, 220, 255));
+			}
+			else if (std::floor(stepPos.x) != columnX)
+			{
+				drawColumn();
+				columnX = std::floor(stepPos.x);
+				columnTop = stepPos.y;
+			}
+			else
+				columnTop = std::fmin(columnTop, stepPos.y);
+		}
+		drawColumn();
+
+		// Live heap at the hovered time
+		ImVec2 lanePos(clipRectPos.x, cursorScreenPosStart.y);
+		ImVec2 laneEnd(clipRectEnd.x, heapBottom);
+		if (ImGui_IsItemHovered(lanePos, laneEnd))
+		{
+			unsigned long long hoveredTime = startTime + (unsigned long long)((ImGui::GetMousePos().x - cursorScreenPosStart.x) / totalProfileLength * displayTime);
+			auto hoveredIt = std::upper_bound(timeline.begin(), timeline.end(), hoveredTime, [](unsigned long long time, const HeapPoint& point) { return time < point.timestamp; });
+			if (hoveredIt != timeline.begin())
+			{
+				hoveredIt--;
+				ImGui::BeginTooltip();
+				ImGui::Text("Live heap: %s (peak %s)", BytesToSize((float)std::max(hoveredIt->liveBytes, 0ll)).c_str(), BytesToSize((float)capture->maxLiveBytes).c_str());
+				ImGui::EndTooltip();
+			}
+		}
+
+		cursorScreenPosStart.y += heapLaneHeight;
+	}
+
+	ImGui::SetCursorScreenPos(cursorScreenPosStart);
+	ImGui::EndChild();
+	
+	// update thread data positions
+	ImGui::BeginChild("ThreadData", ImVec2(ImGui::GetWindowSize().x * 0.15f, 0), false, ImGuiWindowFlags_NoScrollbar);
+	ImVec2 threadDataCursorPos = ImGui::GetCursorPos();
+	ImGui::SetCursorPos(ImVec2(threadDataCursorPos.x, threadDataCursorPos.y + lineheight));
+	if (!capture->heapTimeline.empty())
+	{
+		float heapLabelY = ImGui::GetCursorPos().y;
+		ImGui::Text("Live heap");
+		ImGui::SetCursorPos(ImVec2(threadDataCursorPos.x, heapLabelY + heapLaneHeight));
+	}
+	ImGui::EndChild();
+
+	// Threads are stacked, each one gets its event rows, a row of sample ticks if it was sampled and a row
+	// of lock waits and holds if it had contention. The lock rows are placed up front, waits link to the holder's
+	float threadTop = cursorScreenPosStart.y;
+	std::vector<float> lockRowTops;
+	for (auto it = capture->threads.begin(); it != capture->threads.end(); it++)
+	{
+		float sampleHeight = it->samples.empty() ? 0.0f : itemHeight * 0.5f;
+		float lockHeight = it->lockWaits.empty() && it->lockHolds.empty() ? 0.0f : itemHeight * 0.5f;
+		lockRowTops.push_back(threadTop + itemHeight * (it->maxDepth + 1) + sampleHeight);
+		threadTop += std::fmax(itemHeight * (it->maxDepth + 1) + sampleHeight + lockHeight + itemHeight * 0.5f, ImGui::GetTextLineHeightWithSpacing());
+	}
+
+	auto findThread = [&](uint32_t threadID) -> int
+	{
+		for (size_t i = 0; i < capture->threads.size(); i++)
+		{
+			if (threadID != 0 && capture->threads[i].threadID == threadID)
+				return (int)i;
+		}
+		return -1;
+	};
+
+	// Draw events for each thread
+	for (auto it = capture->threads.begin(); it != capture->threads.end(); it++)
+	{
+		ThreadEventInfo &info = *it;
+
+		float sampleHeight = info.samples.empty() ? 0.0f : itemHeight * 0.5f;
+		float lockHeight = info.lockWaits.empty() && info.lockHolds.empty() ? 0.0f : itemHeight * 0.5f;
+		float threadHeight = std::fmax(itemHeight * (info.maxDepth + 1) + sampleHeight + lockHeight + itemHeight * 0.5f, ImGui::GetTextLineHeightWithSpacing());
+
+		ImGui::BeginChild("ThreadData", ImVec2(ImGui::GetWindowSize().x * 0.15f, 0), false, ImGuiWindowFlags_NoScrollbar);
+		float threadLabelY = ImGui::GetCursorPos().y;
+		ImGui::TextUnformatted(info.threadName); // loaded captures can name threads anything
+		ImGui::SetCursorPos(ImVec2(threadDataCursorPos.x, threadLabelY + threadHeight));
+		ImGui::EndChild();
+
+		// Render event data
+		ImGui::BeginChild("EventData", eventDataSize, false, ImGuiWindowFlags_HorizontalScrollbar);
+
+		unsigned long long visibleStart = startTime + displayTimeStartActual;
+		unsigned long long visibleEnd = startTime + displayTimeStartActual + displayTimeVisibleActual;
+
+		// Use the coarsest level of detail that doesn't merge anything wider than a pixel
+		LodLevel* lod = nullptr;
+		double ticksPerPixel = (double)displayTime / totalProfileLength;
+		for (auto lodIt = info.lodLevels.begin(); lodIt != info.lodLevels.end() && lodIt->resolution <= ticksPerPixel; lodIt++)
+			lod = &(*lodIt);
+
+		if (lod != nullptr)
+		{
+			for (size_t depth = 0; depth < lod->depthSpans.size(); depth++)
+			{
+				std::vector<EventSpan> &spans = lod->depthSpans[depth];
+
+				// Find the first span that ends inside the visible range
+				auto endsBefore = [](const EventSpan& span, unsigned long long time) { return span.endTime < time; };
+				auto spanIt = std::lower_bound(spans.begin(), spans.end(), visibleStart, endsBefore);
+
+				for (; spanIt != spans.end() && spanIt->startTime <= visibleEnd; spanIt++)
+				{
+					// Calculate start pos and size
+					float startP = (float)((float)spanIt->startTime - startTime) / displayTime;
+					ImVec2 spanPos((startP * totalProfileLength) + cursorScreenPosStart.x, cursorScreenPosStart.y + itemHeight * depth);
+					ImVec2 spanSize(((float)(spanIt->endTime - spanIt->startTime) / displayTime) * totalProfileLength, itemHeight);
+					ImVec2 spanEnd(spanPos.x + std::fmax(spanSize.x, 1.0f), spanPos.y + spanSize.y);
+
+					if (ImGui_ClipRect(spanPos, spanEnd, clipRectPos, clipRectEnd))
+					{
+						ImGui::GetWindowDrawList()->AddRectFilled(spanPos, spanEnd, NameRegistry::Get()->GetColor(spanIt->nameID));
+						if (ImGui_IsItemHovered(spanPos, spanEnd))
+						{
+							ImGui::BeginTooltip();
+							if (spanIt->count > 1)
+								ImGui::Text("%u merged events (%.2fms), longest: %s (%.2fms)", spanIt->count, Timer::TicksToNs(spanIt->endTime - spanIt->startTime) * (1.0f / 1e6),
+									NameRegistry::Get()->GetName(spanIt->nameID), Timer::TicksToNs(spanIt->longestDuration) * (1.0f / 1e6));
+							else
+								ImGui::Text("%s (%.2fms)", NameRegistry::Get()->GetName(spanIt->nameID), Timer::TicksToNs(spanIt->longestDuration) * (1.0f / 1e6));
+							ImGui::EndTooltip();
+						}
+					}
+				}
+			}
+		}
+		else
+		{
+			// Zoomed in far enough to draw the events themselves
+			for (auto depthIt = info.depthEvents.begin(); depthIt != info.depthEvents.end(); depthIt++)
+			{
+				// Find the first event that ends inside the visible range
+				auto endsBefore = [](const ProfilerEventManager::ProfilerEvent* ev, unsigned long long time) { return ev->startTime + ev->duration < time; };
+				auto evIt = std::lower_bound(depthIt->begin(), depthIt->end(), visibleStart, endsBefore);
+
+				for (; evIt != depthIt->end(); evIt++)
+				{
+					ProfilerEventManager::ProfilerEvent* ev = *evIt;
+
+					// Clip if event is out of visible range
+					if (ev->startTime > visibleEnd)
+						break;
+
+					// Calculate start pos
+					float startP = (float)((float)ev->startTime - startTime) / displayTime;
+					ImVec2 eventPos((startP * totalProfileLength) + cursorScreenPosStart.x, cursorScreenPosStart.y + itemHeight * ev->depth);
+					// Calculate size
+					ImVec2 eventSize(((float)ev->duration / displayTime) * totalProfileLength, itemHeight);
+					ImVec2 eventEnd(eventPos.x + eventSize.x, eventPos.y + eventSize.y);
+
+					if (ImGui_ClipRect(eventPos, eventEnd, clipRectPos, clipRectEnd))
+					{
+						ImGui::GetWindowDrawList()->AddRectFilled(eventPos, eventEnd, NameRegistry::Get()->GetColor(ev->nameID));
+						if (ImGui_IsItemHovered(eventPos, eventEnd))
+						{
+							ImGui::BeginTooltip();
+							ImGui::Text("%s (%.2fms)", NameRegistry::Get()->GetName(ev->nameID), Timer::TicksToNs(ev->duration) * (1.0f / 1e6));
+							if (info.format == ProfilerEventManager::kRecordCounters)
+							{
+								const unsigned long long* counters = reinterpret_cast<ProfilerEventManager::CountedEvent*>(ev)->counters;
+								unsigned long long cycles = counters[PerfCounters::kCycles];
+								ImGui::Text("IPC %.2f (%llu instructions, %llu cycles)", cycles ? (double)counters[PerfCounters::kInstructions] / cycles : 0.0, counters[PerfCounters::kInstructions], cycles);
+								ImGui::Text("%llu LLC misses, %llu branch misses", counters[PerfCounters::kCacheMisses], counters[PerfCounters::kBranchMisses]);
+							}
+							ImGui::EndTooltip();
+						}
+					}
+				}
+			}
+		}
+
+		// Sample ticks, the hovered one shows its stack
+		if (!info.samples.empty())
+		{
+			float sampleTop = cursorScreenPosStart.y + itemHeight * (info.maxDepth + 1);
+			auto takenBefore = [](const ProfilerEventManager::Sample* sample, unsigned long long time) { return sample->timestamp < time; };
+			auto sampleIt = std::lower_bound(info.samples.begin(), info.samples.end(), visibleStart, takenBefore);
+			const ProfilerEventManager::Sample* hoveredSample = nullptr;
+			float lastX = -1.0f;
+
+			for (; sampleIt != info.samples.end() && (*sampleIt)->timestamp <= visibleEnd; sampleIt++)
+			{
+				// Samples within the same pixel would only draw over each other
+				float startP = (float)((float)(*sampleIt)->timestamp - startTime) / displayTime;
+				ImVec2 samplePos(std::floor((startP * totalProfileLength) + cursorScreenPosStart.x), sampleTop);
+				if (samplePos.x == lastX)
+					continue;
+				lastX = samplePos.x;
+
+				ImVec2 sampleEnd(samplePos.x + 1.0f, sampleTop + sampleHeight);
+				if (ImGui_ClipRect(samplePos, sampleEnd, clipRectPos, clipRectEnd))
+				{
+					ImGui::GetWindowDrawList()->AddRectFilled(samplePos, sampleEnd, IM_COL32(200, 200, 200, 255));
+					if (ImGui_IsItemHovered(ImVec2(samplePos.x - 2.0f, samplePos.y), ImVec2(sampleEnd.x + 2.0f, sampleEnd.y)))
+						hoveredSample = *sampleIt;
+				}
+			}
+
+			if (hoveredSample != nullptr)
+			{
+				ImGui::BeginTooltip();
+				ImGui::Text("Sample at %.3fms", Timer::TicksToNs(hoveredSample->timestamp - startTime) * (1.0f / 1e6));
+				char symbol[256];
+				for (uint32_t i = 0; i < hoveredSample->numFrames; i++)
+				{
+					Sampler::GetSymbol(hoveredSample->frames[i], symbol, sizeof(symbol));
+					ImGui::Text("%s", symbol);
+				}
+				ImGui::EndTooltip();
+			}
+		}
+
+		// Lock holds other threads waited on, and waits linked to the thread holding the lock when they started
+		if (lockHeight > 0.0f)
+		{
+			float lockTop = lockRowTops[it - capture->threads.begin()];
+			auto toX = [&](unsigned long long time) { return (float)((float)time - startTime) / displayTime * totalProfileLength + cursorScreenPosStart.x; };
+
+			// Holds are sorted by end time and none is longer than the longest one
+			auto endsBefore = [](const LockSegment& segment, unsigned long long time) { return segment.endTime < time; };
+			auto holdIt = std::lower_bound(info.lockHolds.begin(), info.lockHolds.end(), visibleStart, endsBefore);
+			for (; holdIt != info.lockHolds.end() && holdIt->endTime <= visibleEnd + info.longestLockHold; holdIt++)
+			{
+				ImVec2 holdPos(toX(holdIt->startTime), lockTop);
+				ImVec2 holdEnd(std::fmax(toX(holdIt->endTime), holdPos.x + 1.0f), lockTop + lockHeight);
+				if (!ImGui_ClipRect(holdPos, holdEnd, clipRectPos, clipRectEnd))
+					continue;
+
+				ImGui::GetWindowDrawList()->AddRectFilled(holdPos, holdEnd, IM_COL32(230, 150, 40, 255));
+				if (ImGui_IsItemHovered(holdPos, holdEnd))
+				{
+					ImGui::BeginTooltip();
+					if (holdIt->shared)
+						ImGui::Text("%s released by a reader with waiters", NameRegistry::Get()->GetName(holdIt->nameID));
+					else
+						ImGui::Text("%s held for %.3fms with waiters", NameRegistry::Get()->GetName(holdIt->nameID), Timer::TicksToNs(holdIt->endTime - holdIt->startTime) * (1.0f / 1e6));
+					ImGui::EndTooltip();
+				}
+			}
+
+			// Waits don't overlap, a thread blocks on one lock at a time
+			auto waitIt = std::lower_bound(info.lockWaits.begin(), info.lockWaits.end(), visibleStart, endsBefore);
+			for (; waitIt != info.lockWaits.end() && waitIt->startTime <= visibleEnd; waitIt++)
+			{
+				ImVec2 waitPos(toX(waitIt->startTime), lockTop);
+				ImVec2 waitEnd(std::fmax(toX(waitIt->endTime), waitPos.x + 1.0f), lockTop + lockHeight);
+				if (!ImGui_ClipRect(waitPos, waitEnd, clipRectPos, clipRectEnd))
+					continue;
+
+				ImGui::GetWindowDrawList()->AddRectFilled(waitPos, waitEnd, IM_COL32(220, 50, 50, 255));
+
+				int holder = findThread(waitIt->holderThreadID);
+				if (holder >= 0)
+				{
+					float holderY = lockRowTops[holder] + lockHeight * 0.5f;
+					ImGui::GetWindowDrawList()->AddLine(ImVec2(waitEnd.x, lockTop + lockHeight * 0.5f), ImVec2(waitEnd.x, holderY), IM_COL32(220, 50, 50, 160));
+				}
+
+				if (ImGui_IsItemHovered(waitPos, waitEnd))
+				{
+					ImGui::BeginTooltip();
+					ImGui::Text("Waited %.3fms for %s%s", Timer::TicksToNs(waitIt->endTime - waitIt->startTime) * (1.0f / 1e6), NameRegistry::Get()->GetName(waitIt->nameID), waitIt->shared ? " (shared)" : "");
+					if (holder >= 0)
+						ImGui::Text("Held by %s", capture->threads[holder].threadName);
+					else
+						ImGui::Text("Held by readers or an unknown thread");
+					ImGui::EndTooltip();
+				}
+			}
+		}
+		ImGui::EndChild();
+
+		cursorScreenPosStart.y += threadHeight;
+	}
+
+
+  ImGui::End(); // end profiler window
+
+  if (m_showCallTree)
+    RenderCallTree(capture);
+}
+
+void Profiler::RenderScopeStats(Capture* capture)
+{
+  enum StatsColumn { kColumnName = 0, kColumnCount, kColumnInclusive, kColumnExclusive, kColumnMin, kColumnMax, kColumnP50, kColumnP99, kColumnAllocated, kNumColumns };
+  static const char* columnNames[kNumColumns] = { "Name", "Count", "Incl. ms", "Excl. ms", "Min us", "Max us", "p50 us", "p99 us", "Alloc KB" };
+
+  // Sort again when the order changed, or for a new capture
+  if (capture->statsSortColumn != m_statsSortColumn || capture->statsSortDescending != m_statsSortDescending)
+  {
+    int column = m_statsSortColumn;
+    auto key = [column](const ScopeStats& stats) -> unsigned long long
+    {
+      switch (column)
+      {
+      case kColumnCount: return stats.count;
+      case kColumnInclusive: return stats.inclusiveTime;
+      case kColumnExclusive: return stats.exclusiveTime;
+      case kColumnMin: return stats.minTime;
+      case kColumnMax: return stats.maxTime;
+      case kColumnP50: return stats.p50Time;
+      case kColumnP99: return stats.p99Time;
+      default: return stats.allocatedBytes;
+      }
+    };
+    auto before = [column, key](const ScopeStats& a, const ScopeStats& b)
+    {
+      if (column == kColumnName)
+        return strcmp(NameRegistry::Get()->GetName(a.nameID), NameRegistry::Get()->GetName(b.nameID)) < 0;
+      return key(a) < key(b);
+    };
+
+    if (m_statsSortDescending)
+      std::stable_sort(capture->scopeStats.begin(), capture->scopeStats.end(), [before](const ScopeStats& a, const ScopeStats& b) { return before(b, a); });
+    else
+      std::stable_sort(capture->scopeStats.begin(), capture->scopeStats.end(), before);
+
+    capture->statsSortColumn = m_statsSortColumn;
+    capture->statsSortDescending = m_statsSortDescending;
+  }
+
+  ImGui::Text("%u names, click a column to sort", (uint32_t)capture->scopeStats.size());
+  ImGui::Columns(kNumColumns, "ScopeStatsColumns");
+  for (int column = 0; column < kNumColumns; column++)
+  {
+    // The ID stays the same when the sort arrow changes
+    char label[64];
+    snprintf(label, sizeof(label), "%s%s##StatsColumn%d", columnNames[column], column == m_statsSortColumn ? (m_statsSortDescending ? " v" : " ^") : "", column);
+    if (ImGui::Selectable(label, column == m_statsSortColumn))
+    {
+      if (column == m_statsSortColumn)
+        m_statsSortDescending = !m_statsSortDescending;
+      else
+      {
+        m_statsSortColumn = column;
+        m_statsSortDescending = column != kColumnName; // names sort alphabetically, numbers largest first
+      }
+    }
+    ImGui::NextColumn();
+  }
+  ImGui::Separator();
+
+  double msPerTick = Timer::TicksToNs(1000000) * (1.0 / 1e12);
+  double usPerTick = Timer::TicksToNs(1000000) * (1.0 / 1e9);
+
+  // Only the visible rows are drawn
+  ImGuiListClipper clipper((int)capture->scopeStats.size());
+  while (clipper.Step())
+  {
+    for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+    {
+      const ScopeStats &stats = capture->scopeStats[i];
+      ImGui::TextColored(ImGui::ColorConvertU32ToFloat4(NameRegistry::Get()->GetColor(stats.nameID)), "%s", NameRegistry::Get()->GetName(stats.nameID));
+      ImGui::NextColumn();
+      ImGui::Text("%u", stats.count);
+      ImGui::NextColumn();
+      ImGui::Text("%.3f", stats.inclusiveTime * msPerTick);
+      ImGui::NextColumn();
+      ImGui::Text("%.3f", stats.exclusiveTime * msPerTick);
+      ImGui::NextColumn();
+      ImGui::Text("%.2f", stats.minTime * usPerTick);
+      ImGui::NextColumn();
+      ImGui::Text("%.2f", stats.maxTime * usPerTick);
+      ImGui::NextColumn();
+      ImGui::Text("%.2f", stats.p50Time * usPerTick);
+      ImGui::NextColumn();
+      ImGui::Text("%.2f", stats.p99Time * usPerTick);
+      ImGui::NextColumn();
+      ImGui::Text("%.1f", stats.allocatedBytes * (1.0 / 1024));
+      ImGui::NextColumn();
+    }
+  }
+  ImGui::Columns(1);
+}
+
+void Profiler::RenderCallTree(Capture* capture)
+{
+  ImGui::SetNextWindowSize(ImVec2(800, 400), ImGuiSetCond_FirstUseEver);
+  if (!ImGui::Begin("Call Tree", &m_showCallTree))
+  {
+    ImGui::End();
+    return;
+  }
+
+  if (ImGui::RadioButton("Flame Graph", m_callTreeAsFlameGraph))
+    m_callTreeAsFlameGraph = true;
+  ImGui::SameLine();
+  if (ImGui::RadioButton("Tree", !m_callTreeAsFlameGraph))
+    m_callTreeAsFlameGraph = false;
+
+  if (capture->callTree.size() <= 1)
+  {
+    ImGui::Text("No events in this capture");
+    ImGui::End();
+    return;
+  }
+
+  if (m_callTreeAsFlameGraph)
+    RenderFlameGraph(capture);
+  else
+  {
+    ImGui::BeginChild("CallTreeNodes");
+    ImGui::Columns(4, "CallTreeColumns");
+    ImGui::Text("Name");
+    ImGui::NextColumn();
+    ImGui::Text("Incl. ms");
+    ImGui::NextColumn();
+    ImGui::Text("Excl. ms");
+    ImGui::NextColumn();
+    ImGui::Text("Calls");
+    ImGui::NextColumn();
+    ImGui::Separator();
+
+    for (uint32_t child = capture->callTree[CallTreeNode::kRoot].firstChild; child != CallTreeNode::kInvalidNode; child = capture->callTree[child].nextSibling)
+      RenderCallTreeNode(capture, child);
+
+    ImGui::Columns(1);
+    ImGui::EndChild();
+  }
+
+  ImGui::End();
+}
+
+void Profiler::RenderCallTreeNode(Capture* capture, uint32_t nodeIndex)
+{
+  const CallTreeNode &node = capture->callTree[nodeIndex];
+  double msPerTick = Timer::TicksToNs(1000000) * (1.0 / 1e12);
+
+  ImGuiTreeNodeFlags flags = node.firstChild == CallTreeNode::kInvalidNode ? ImGuiTreeNodeFlags_Leaf : 0;
+  bool open = ImGui::TreeNodeEx((void*)(intptr_t)nodeIndex, flags, "%s", NameRegistry::Get()->GetName(node.nameID));
+  ImGui::NextColumn();
+  ImGui::Text("%.3f", node.inclusiveTime * msPerTick);
+  ImGui::NextColumn();
+  ImGui::Text("%.3f", node.exclusiveTime * msPerTick);
+  ImGui::NextColumn();
+  ImGui::Text("%u", node.count);
+  ImGui::NextColumn();
+
+  // Children are only visited for open nodes
+  if (open)
+  {
+    for (uint32_t child = node.firstChild; child != CallTreeNode::kInvalidNode; child = capture->callTree[child].nextSibling)
+      RenderCallTreeNode(capture, child);
+    ImGui::TreePop();
+  }
+}
+
+void Profiler::RenderFlameGraph(Capture* capture)
+{
+  std::vector<CallTreeNode> &nodes = capture->callTree;
+  double msPerTick = Timer::TicksToNs(1000000) * (1.0 / 1e12);
+
+  if (capture->callTreeFocus >= nodes.size())
+    capture->callTreeFocus = CallTreeNode::kRoot;
+  uint32_t focusIndex = capture->callTreeFocus;
+  const CallTreeNode &focus = nodes[focusIndex];
+
+  ImGui::SameLine();
+  if (focusIndex != CallTreeNode::kRoot)
+  {
+    if (ImGui::Button("Zoom Out"))
+      capture->callTreeFocus = focus.parent;
+    ImGui::SameLine();
+    if (ImGui::Button("Reset"))
+      capture->callTreeFocus = CallTreeNode::kRoot;
+    ImGui::SameLine();
+    ImGui::Text("%s, %.3f ms", NameRegistry::Get()->GetName(focus.nameID), focus.inclusiveTime * msPerTick);
+  }
+  else
+    ImGui::Text("All threads, %.3f ms. Click a node to zoom in", focus.inclusiveTime * msPerTick);
+
+  ImGui::BeginChild("FlameGraph");
+  ImDrawList* drawList = ImGui::GetWindowDrawList();
+  ImVec2 origin = ImGui::GetCursorScreenPos();
+  float width = ImGui::GetContentRegionAvail().x;
+  float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+  float visibleTop = ImGui::GetWindowPos().y;
+  float visibleBottom = visibleTop + ImGui::GetWindowSize().y;
+  double pixelsPerTick = focus.inclusiveTime > 0 ? width / (double)focus.inclusiveTime : 0.0;
+
+  // Icicle layout, the focused node spans the width at the top and children are drawn below their parent
+  struct DrawItem
+  {
+    uint32_t node;
+    float x;
+  };
+  std::vector<DrawItem> stack;
+  DrawItem first = { focusIndex, 0.0f };
+  stack.push_back(first);
+  uint32_t hovered = CallTreeNode::kInvalidNode;
+  uint32_t rows = 0;
+
+  while (!stack.empty())
+  {
+    DrawItem item = stack.back();
+    stack.pop_back();
+
+    const CallTreeNode &node = nodes[item.node];
+    float nodeWidth = (float)(node.inclusiveTime * pixelsPerTick);
+    uint32_t row = node.depth - focus.depth;
+    rows = std::max(rows, row + 1);
+
+    ImVec2 nodePos(origin.x + item.x, origin.y + row * rowHeight);
+    ImVec2 nodeEnd(nodePos.x + std::max(nodeWidth - 1.0f, 1.0f), nodePos.y + rowHeight - 1.0f);
+    if (nodeEnd.y >= visibleTop && nodePos.y <= visibleBottom)
+    {
+      bool isRoot = item.node == CallTreeNode::kRoot;
+      drawList->AddRectFilled(nodePos, nodeEnd, isRoot ? IM_COL32(100, 100, 100, 255) : NameRegistry::Get()->GetColor(node.nameID));
+
+      // Names are clipped to their node, and left out once there's no room for a few characters
+      if (nodeWidth > ImGui::GetFontSize() * 2.0f)
+      {
+        ImVec4 clipRect(nodePos.x, nodePos.y, nodeEnd.x - 2.0f, nodeEnd.y);
+        drawList->AddText(ImGui::GetFont(), ImGui::GetFontSize(), ImVec2(nodePos.x + 2.0f, nodePos.y), IM_COL32_BLACK,
+          isRoot ? "All threads" : NameRegistry::Get()->GetName(node.nameID), nullptr, 0.0f, &clipRect);
+      }
+
+      if (ImGui::IsMouseHoveringRect(nodePos, nodeEnd))
+        hovered = item.node;
+    }
+
+    // Children are sorted largest first, so everything after the first one narrower than a pixel is skipped
+    float childX = item.x;
+    for (uint32_t child = node.firstChild; child != CallTreeNode::kInvalidNode; child = nodes[child].nextSibling)
+    {
+      float childWidth = (float)(nodes[child].inclusiveTime * pixelsPerTick);
+      if (childWidth < 1.0f)
+        break;
+
+      DrawItem childItem = { child, childX };
+      stack.push_back(childItem);
+      childX += childWidth;
+    }
+  }
+
+  // Reserve the height of the graph, so the child window scrolls
+  ImGui::Dummy(ImVec2(width, rows * rowHeight));
+
+  if (hovered != CallTreeNode::kInvalidNode && ImGui::IsWindowHovered())
+  {
+    const CallTreeNode &node = nodes[hovered];
+    ImGui::BeginTooltip();
+    ImGui::Text("%s", hovered == CallTreeNode::kRoot ? "All threads" : NameRegistry::Get()->GetName(node.nameID));
+    ImGui::Text("Inclusive: %.3f ms (%.1f%%)", node.inclusiveTime * msPerTick, focus.inclusiveTime > 0 ? 100.0 * node.inclusiveTime / focus.inclusiveTime : 0.0);
+    ImGui::Text("Exclusive: %.3f ms", node.exclusiveTime * msPerTick);
+    ImGui::Text("Calls: %u", node.count);
+    ImGui::EndTooltip();
+
+    if (ImGui::IsMouseClicked(0))
+      capture->callTreeFocus = hovered;
+  }
+
+  ImGui::EndChild();
+}
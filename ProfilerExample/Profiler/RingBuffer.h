@@ -0,0 +1,49 @@
+#ifndef _RING_BUFFER_H
+#define _RING_BUFFER_H
+
+#include <vector>
+
+// Fixed capacity FIFO, pushing into a full buffer overwrites the oldest element
+template <typename T>
+class RingBuffer
+{
+public:
+  RingBuffer(uint32_t capacity) : m_data(capacity), m_head(0), m_size(0) {}
+
+  void PushBack(const T& value)
+  {
+    uint32_t capacity = Capacity();
+    m_data[(m_head + m_size) % capacity] = value;
+
+    if (m_size < capacity)
+      m_size++;
+    else
+      m_head = (m_head + 1) % capacity;
+  }
+
+  void PopFront()
+  {
+    m_head = (m_head + 1) % Capacity();
+    m_size--;
+  }
+
+  void Clear() { m_head = m_size = 0; }
+
+  // Index 0 is the oldest element
+  T& operator[](uint32_t index) { return m_data[(m_head + index) % Capacity()]; }
+  const T& operator[](uint32_t index) const { return m_data[(m_head + index) % Capacity()]; }
+
+  T& Front() { return (*this)[0]; }
+  T& Back() { return (*this)[m_size - 1]; }
+
+  uint32_t Size() const { return m_size; }
+  uint32_t Capacity() const { return (uint32_t)m_data.size(); }
+  bool Empty() const { return m_size == 0; }
+
+private:
+  std::vector<T> m_data;
+  uint32_t m_head; // index of the oldest element
+  uint32_t m_size;
+};
+
+#endif
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include "Sampler.h"
+#include "Profiler.h"
+#include "Timer.h"
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define SAMPLER_SUPPORTED 1
+#else
+#define SAMPLER_SUPPORTED 0
+#endif
+
+#if SAMPLER_SUPPORTED
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+
+// glibc doesn't name the field SIGEV_THREAD_ID uses
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// Set while sampling, signals that arrive later are dropped
+static std::atomic<bool> s_samplerActive(false);
+
+// Clock measuring the CPU time of a thread, same encoding as glibc's pthread_getcpuclockid
+static clockid_t GetThreadCPUClock(uint32_t tid)
+{
+  return (clockid_t)((~(unsigned int)tid << 3) | 6); // CPUCLOCK_SCHED | CPUCLOCK_PERTHREAD
+}
+
+static void SampleSignalHandler(int, siginfo_t*, void* context)
+{
+  int savedErrno = errno;
+
+  ProfilerEventManager* mngr = Profiler::GetCurrentEventManager();
+  if (mngr != nullptr && s_samplerActive.load(std::memory_order_relaxed))
+  {
+    const ucontext_t* uc = reinterpret_cast<const ucontext_t*>(context);
+#if defined(__x86_64__)
+    uintptr_t pc = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+    uintptr_t fp = (uintptr_t)uc->uc_mcontext.gregs[REG_RBP];
+#else
+    uintptr_t pc = (uintptr_t)uc->uc_mcontext.pc;
+    uintptr_t fp = (uintptr_t)uc->uc_mcontext.regs[29];
+#endif
+    const Sampler::ThreadState &state = mngr->GetSamplerState();
+
+    // Each frame starts with the caller's frame pointer followed by the return address.
+    // Frames have to stay on this thread's stack and move towards its base, anything else ends the walk
+    uint64_t frames[ProfilerEventManager::kMaxSampleFrames];
+    uint32_t numFrames = 0;
+    frames[numFrames++] = pc;
+    while (numFrames < ProfilerEventManager::kMaxSampleFrames)
+    {
+      if (fp < state.stackLow || fp + 2 * sizeof(uintptr_t) > state.stackHigh || (fp & (sizeof(uintptr_t) - 1)) != 0)
+        break;
+
+      const uintptr_t* frame = reinterpret_cast<const uintptr_t*>(fp);
+      if (frame[1] == 0)
+        break;
+      frames[numFrames++] = frame[1];
+
+      if (frame[0] <= fp)
+        break;
+      fp = frame[0];
+    }
+
+    mngr->AddSample(Timer::Now(), frames, numFrames);
+  }
+
+  errno = savedErrno;
+}
+#endif
+
+bool Sampler::IsSupported()
+{
+  return SAMPLER_SUPPORTED != 0;
+}
+
+void Sampler::InitThread(ThreadState& state)
+{
+  state.timer = nullptr;
+  state.hasTimer = false;
+  state.stackLow = state.stackHigh = 0;
+
+#if SAMPLER_SUPPORTED
+  pthread_attr_t attr;
+  if (pthread_getattr_np(pthread_self(), &attr) == 0)
+  {
+    void* stackAddr = nullptr;
+    size_t stackSize = 0;
+    if (pthread_attr_getstack(&attr, &stackAddr, &stackSize) == 0)
+    {
+      state.stackLow = (uintptr_t)stackAddr;
+      state.stackHigh = state.stackLow + stackSize;
+    }
+    pthread_attr_destroy(&attr);
+  }
+#endif
+}
+
+bool Sampler::Start(uint32_t frequency, ProfilerEventManager* managers)
+{
+#if SAMPLER_SUPPORTED
+  if (m_running || frequency == 0 || frequency > kMaxFrequency)
+    return false;
+
+  if (!m_handlerInstalled)
+  {
+    struct sigaction action = {};
+    action.sa_sigaction = SampleSignalHandler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, nullptr) != 0)
+      return false;
+    m_handlerInstalled = true;
+  }
+
+  m_frequency = frequency;
+  m_running = true;
+  s_samplerActive.store(true, std::memory_order_relaxed);
+  Update(managers);
+  return true;
+#else
+  (void)frequency;
+  (void)managers;
+  return false;
+#endif
+}
+
+void Sampler::Stop(ProfilerEventManager* managers)
+{
+  if (!m_running)
+    return;
+
+  m_running = false;
+#if SAMPLER_SUPPORTED
+  s_samplerActive.store(false, std::memory_order_relaxed);
+#endif
+
+  for (ProfilerEventManager* mngr = managers; mngr != nullptr; mngr = mngr->GetNext())
+  {
+    RemoveThread(mngr);
+
+    // Recorded samples stay until they expire, only the spare page goes back
+    if (MemoryPager::Page* spare = mngr->m_spareSamplePage.exchange(nullptr, std::memory_order_acquire))
+      MemoryPager::Get()->ReleasePage(spare);
+  }
+}
+
+void Sampler::Update(ProfilerEventManager* managers)
+{
+  for (ProfilerEventManager* mngr = managers; mngr != nullptr; mngr = mngr->GetNext())
+  {
+    if (mngr->IsRetired())
+    {
+      RemoveThread(mngr);
+      continue;
+    }
+
+    // The handler can't allocate, so it always gets a page ready to switch to
+    if (mngr->m_spareSamplePage.load(std::memory_order_relaxed) == nullptr)
+      mngr->m_spareSamplePage.store(MemoryPager::Get()->GetPage(), std::memory_order_release);
+
+    if (!mngr->m_samplerState.hasTimer)
+      AddThread(mngr);
+  }
+}
+
+bool Sampler::AddThread(ProfilerEventManager* mngr)
+{
+#if SAMPLER_SUPPORTED
+  ThreadState &state = mngr->m_samplerState;
+
+  struct sigevent event = {};
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo = SIGPROF;
+  event.sigev_notify_thread_id = (pid_t)mngr->GetThreadID();
+
+  timer_t timer;
+  if (timer_create(GetThreadCPUClock(mngr->GetThreadID()), &event, &timer) != 0)
+    return false;
+
+  long intervalNs = 1000000000L / (long)m_frequency;
+  struct itimerspec spec = {};
+  spec.it_interval.tv_sec = intervalNs / 1000000000L;
+  spec.it_interval.tv_nsec = intervalNs % 1000000000L;
+  spec.it_value = spec.it_interval;
+  if (timer_settime(timer, 0, &spec, nullptr) != 0)
+  {
+    timer_delete(timer);
+    return false;
+  }
+
+  state.timer = timer;
+  state.hasTimer = true;
+  return true;
+#else
+  (void)mngr;
+  return false;
+#endif
+}
+
+void Sampler::RemoveThread(ProfilerEventManager* mngr)
+{
+  ThreadState &state = mngr->m_samplerState;
+  if (!state.hasTimer)
+    return;
+
+#if SAMPLER_SUPPORTED
+  timer_delete((timer_t)state.timer);
+#endif
+  state.timer = nullptr;
+  state.hasTimer = false;
+}
+
+void Sampler::GetSymbol(uint64_t address, char* buffer, size_t size)
+{
+#if SAMPLER_SUPPORTED
+  // Only exported symbols are found, link with -rdynamic to see the executable's own functions
+  Dl_info info;
+  if (dladdr((void*)(uintptr_t)address, &info) != 0)
+  {
+    if (info.dli_sname != nullptr)
+    {
+      int status = 0;
+      char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+      snprintf(buffer, size, "%s+0x%llx", status == 0 ? demangled : info.dli_sname, (unsigned long long)(address - (uintptr_t)info.dli_saddr));
+      free(demangled);
+      return;
+    }
+
+    if (info.dli_fname != nullptr)
+    {
+      // Module relative, so it can be passed to addr2line
+      const char* fileName = info.dli_fname;
+      for (const char* c = info.dli_fname; *c; c++)
+      {
+        if (*c == '/')
+          fileName = c + 1;
+      }
+      snprintf(buffer, size, "%s+0x%llx", fileName, (unsigned long long)(address - (uintptr_t)info.dli_fbase));
+      return;
+    }
+  }
+#endif
+  snprintf(buffer, size, "0x%llx", (unsigned long long)address);
+}
@@ -0,0 +1,60 @@
+#ifndef _SAMPLER_H
+#define _SAMPLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class ProfilerEventManager;
+
+/*
+* Sampling profiler, runs alongside the instrumentation. Linux only, Start fails elsewhere
+* Every thread with an event manager gets a timer on its own CPU clock that sends it SIGPROF, so idle threads
+* aren't sampled. The signal handler walks the stack through frame pointers and stores the sample in the thread's
+* sample pages, code built without frame pointers (-fno-omit-frame-pointer) only shows the interrupted function
+*/
+class Sampler
+{
+public:
+  static const uint32_t kDefaultFrequency = 1000; // in Hz
+  static const uint32_t kMaxFrequency = 10000;
+
+  // Per thread state, kept in the thread's event manager
+  struct ThreadState
+  {
+    void* timer;          // timer_t, only valid if hasTimer is set
+    bool hasTimer;
+    uintptr_t stackLow;   // frame pointers outside the thread's stack aren't followed
+    uintptr_t stackHigh;
+  };
+
+  Sampler() : m_running(false), m_handlerInstalled(false), m_frequency(kDefaultFrequency) {}
+
+  static bool IsSupported();
+
+  // Reads the stack bounds, has to be called on the thread itself
+  static void InitThread(ThreadState& state);
+
+  // Only called from the frame thread, managers is the head of the profiler's manager list
+  bool Start(uint32_t frequency, ProfilerEventManager* managers);
+  void Stop(ProfilerEventManager* managers);
+  bool IsRunning() { return m_running; }
+  uint32_t GetFrequency() { return m_frequency; }
+
+  // Once per frame: starts timers for new threads, stops them for exited ones and refills the pages samples are written to
+  void Update(ProfilerEventManager* managers);
+
+  // Stops the thread's timer, has to be called before its manager is deleted
+  void RemoveThread(ProfilerEventManager* mngr);
+
+  // Describes a sampled address as "function+offset" or "module+offset", not signal safe
+  static void GetSymbol(uint64_t address, char* buffer, size_t size);
+
+private:
+  bool AddThread(ProfilerEventManager* mngr);
+
+  bool m_running;
+  bool m_handlerInstalled; // the handler stays installed after Stop, signals that are still pending get dropped
+  uint32_t m_frequency;
+};
+
+#endif
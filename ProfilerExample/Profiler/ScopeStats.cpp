@@ -0,0 +1,149 @@
+#include "ScopeStats.h"
+
+// Index of the highest set bit, value can't be 0
+static uint32_t HighestBit(unsigned long long value)
+{
+  uint32_t bit = 0;
+  for (uint32_t step = 32; step > 0; step >>= 1)
+  {
+    if (value >> (bit + step))
+      bit += step;
+  }
+  return bit;
+}
+
+static unsigned long long Clamp(unsigned long long value, unsigned long long minValue, unsigned long long maxValue)
+{
+  return value < minValue ? minValue : value > maxValue ? maxValue : value;
+}
+
+uint32_t DurationHistogram::GetBucket(unsigned long long value)
+{
+  if (value < kSubBuckets)
+    return (uint32_t)value;
+
+  uint32_t shift = HighestBit(value) - kSubBucketBits;
+  return (shift + 1) * kSubBuckets + (uint32_t)((value >> shift) & (kSubBuckets - 1));
+}
+
+unsigned long long DurationHistogram::GetBucketStart(uint32_t bucket)
+{
+  if (bucket < kSubBuckets)
+    return bucket;
+
+  uint32_t shift = bucket / kSubBuckets - 1;
+  return (unsigned long long)(kSubBuckets + bucket % kSubBuckets) << shift;
+}
+
+unsigned long long DurationHistogram::GetBucketSize(uint32_t bucket)
+{
+  return bucket < kSubBuckets ? 1 : 1ull << (bucket / kSubBuckets - 1);
+}
+
+void DurationHistogram::Add(unsigned long long duration)
+{
+  uint32_t bucket = GetBucket(duration);
+  if (bucket >= m_buckets.size())
+    m_buckets.resize(bucket + 1, 0);
+
+  m_buckets[bucket]++;
+  m_count++;
+}
+
+unsigned long long DurationHistogram::GetQuantile(double quantile) const
+{
+  if (m_count == 0)
+    return 0;
+
+  // Rank of the value we're looking for, counted from 1
+  unsigned long long rank = (unsigned long long)(quantile * m_count + 0.5);
+  if (rank < 1)
+    rank = 1;
+  if (rank > m_count)
+    rank = m_count;
+
+  unsigned long long seen = 0;
+  for (uint32_t bucket = 0; bucket < m_buckets.size(); bucket++)
+  {
+    seen += m_buckets[bucket];
+    if (seen >= rank)
+      return GetBucketStart(bucket) + GetBucketSize(bucket) / 2; // middle of the bucket halves the error
+  }
+  return GetBucketStart((uint32_t)m_buckets.size() - 1);
+}
+
+uint32_t ScopeStatsBuilder::GetEntry(uint32_t nameID)
+{
+  if (nameID >= m_entryIndex.size())
+    m_entryIndex.resize(nameID + 1, (uint32_t)kInvalidEntry);
+
+  uint32_t entryIndex = m_entryIndex[nameID];
+  if (entryIndex == kInvalidEntry)
+  {
+    entryIndex = m_entryIndex[nameID] = (uint32_t)m_entries.size();
+    m_entries.push_back(Entry());
+
+    ScopeStats &stats = m_entries.back().stats;
+    stats.nameID = nameID;
+    stats.count = 0;
+    stats.inclusiveTime = stats.exclusiveTime = 0;
+    stats.minTime = ~0ull;
+    stats.maxTime = 0;
+    stats.p50Time = stats.p99Time = 0;
+    stats.allocatedBytes = 0;
+    stats.allocations = 0;
+  }
+  return entryIndex;
+}
+
+void ScopeStatsBuilder::AddAllocation(uint32_t nameID, unsigned long long bytes)
+{
+  ScopeStats &stats = m_entries[GetEntry(nameID)].stats;
+  stats.allocatedBytes += bytes;
+  stats.allocations++;
+}
+
+void ScopeStatsBuilder::AddEvent(unsigned long long startTime, unsigned long long duration, uint32_t nameID, uint32_t depth)
+{
+  uint32_t entryIndex = GetEntry(nameID);
+  Entry &entry = m_entries[entryIndex];
+  entry.stats.count++;
+  entry.stats.inclusiveTime += duration;
+  entry.stats.exclusiveTime += duration;
+  entry.stats.minTime = duration < entry.stats.minTime ? duration : entry.stats.minTime;
+  entry.stats.maxTime = duration > entry.stats.maxTime ? duration : entry.stats.maxTime;
+  entry.histogram.Add(duration);
+
+  // The parent is the last event one level up, if it's still running. It can be missing when the capture starts inside it
+  if (depth > 0 && depth - 1 < m_openScopes.size())
+  {
+    OpenScope &parent = m_openScopes[depth - 1];
+    if (parent.entry != kInvalidEntry && startTime < parent.endTime)
+      m_entries[parent.entry].stats.exclusiveTime -= duration;
+  }
+
+  if (depth >= m_openScopes.size())
+  {
+    OpenScope empty = { kInvalidEntry, 0 };
+    m_openScopes.resize(depth + 1, empty);
+  }
+  OpenScope scope = { entryIndex, startTime + duration };
+  m_openScopes[depth] = scope;
+}
+
+void ScopeStatsBuilder::Finish(std::vector<ScopeStats>& stats)
+{
+  stats.clear();
+  stats.reserve(m_entries.size());
+  for (auto it = m_entries.begin(); it != m_entries.end(); it++)
+  {
+    // Names that only allocated inside events that were still running have no times
+    if (it->stats.count == 0)
+      it->stats.minTime = 0;
+
+    // Quantiles are approximated, keep them inside the exact range
+    it->stats.p50Time = Clamp(it->histogram.GetQuantile(0.5), it->stats.minTime, it->stats.maxTime);
+    it->stats.p99Time = Clamp(it->histogram.GetQuantile(0.99), it->stats.minTime, it->stats.maxTime);
+    stats.push_back(it->stats);
+  }
+}
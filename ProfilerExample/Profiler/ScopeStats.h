@@ -0,0 +1,79 @@
+#ifndef _SCOPE_STATS_H
+#define _SCOPE_STATS_H
+
+#include <stdint.h>
+#include <vector>
+
+// Log-bucketed histogram of durations, quantiles come back within ~1.6% of the exact value
+class DurationHistogram
+{
+public:
+  DurationHistogram() : m_count(0) {}
+
+  void Add(unsigned long long duration);
+  unsigned long long GetQuantile(double quantile) const; // quantile in [0, 1], 0 if the histogram is empty
+
+private:
+  // Values below kSubBuckets get exact buckets, every power of two above that is split into kSubBuckets
+  static const uint32_t kSubBucketBits = 5;
+  static const uint32_t kSubBuckets = 1 << kSubBucketBits;
+
+  static uint32_t GetBucket(unsigned long long value);
+  static unsigned long long GetBucketStart(uint32_t bucket);
+  static unsigned long long GetBucketSize(uint32_t bucket);
+
+  std::vector<uint32_t> m_buckets; // grows up to the highest bucket seen
+  unsigned long long m_count;
+};
+
+// Aggregates over all events with the same name in a capture, times are in timer ticks
+struct ScopeStats
+{
+  uint32_t nameID;
+  uint32_t count;
+  unsigned long long inclusiveTime;
+  unsigned long long exclusiveTime; // inclusive time minus the time spent in child events
+  unsigned long long minTime;
+  unsigned long long maxTime;
+  unsigned long long p50Time;
+  unsigned long long p99Time;
+  unsigned long long allocatedBytes; // allocated while this was the innermost event, estimated when allocations are sampled
+  uint32_t allocations;              // recorded allocations
+};
+
+/*
+* Builds ScopeStats in a single pass over each thread's events
+* Events of a thread have to be added in start order, parents before children that start at the same time
+*/
+class ScopeStatsBuilder
+{
+public:
+  void BeginThread() { m_openScopes.clear(); }
+  void AddEvent(unsigned long long startTime, unsigned long long duration, uint32_t nameID, uint32_t depth);
+  void AddAllocation(uint32_t nameID, unsigned long long bytes);
+  void Finish(std::vector<ScopeStats>& stats); // computes the quantiles, stats are in order of first appearance
+
+private:
+  static const uint32_t kInvalidEntry = 0xFFFFFFFF;
+
+  struct Entry
+  {
+    ScopeStats stats;
+    DurationHistogram histogram;
+  };
+
+  // Last event seen per depth, children subtract their duration from its exclusive time
+  struct OpenScope
+  {
+    uint32_t entry;
+    unsigned long long endTime;
+  };
+
+  uint32_t GetEntry(uint32_t nameID);
+
+  std::vector<uint32_t> m_entryIndex; // per name ID, name IDs are dense so this is indexed directly
+  std::vector<Entry> m_entries;
+  std::vector<OpenScope> m_openScopes;
+};
+
+#endif
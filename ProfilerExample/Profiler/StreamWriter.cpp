@@ -0,0 +1,227 @@
+#include <string.h>
+#include <chrono>
+#include "StreamWriter.h"
+#include "Profiler.h"
+#include "Timer.h"
+
+StreamWriter::StreamWriter() : m_stop(false), m_bytesWritten(0), m_queuedPages(0)
+{
+}
+
+StreamWriter::~StreamWriter()
+{
+  // Doesn't flush, the writer thread releases pages to the pager, which may already be destroyed at this point.
+  // Stop has to be called first, a writer that's still running terminates the process like any joinable std::thread
+}
+
+bool StreamWriter::Start(const char* path)
+{
+  if (IsRunning())
+    return false;
+
+  if (!m_file.Open(path))
+    return false;
+
+  m_path = path;
+  m_stop = false;
+  m_bytesWritten = m_file.GetBytesWritten();
+  m_thread = std::thread(&StreamWriter::Run, this);
+  return true;
+}
+
+void StreamWriter::Stop()
+{
+  if (!IsRunning())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_condition.notify_one();
+  m_thread.join();
+}
+
+void StreamWriter::AddThread(uint32_t threadIndex, uint32_t threadID, const char* name)
+{
+  Item item;
+  item.type = kItemThread;
+  item.threadIndex = threadIndex;
+  item.threadID = threadID;
+  item.page = nullptr;
+  snprintf(item.threadName, sizeof(item.threadName), "%s", name);
+  Queue(item);
+}
+
+void StreamWriter::AddFrame(unsigned long long startTime, unsigned long long duration, uint32_t color)
+{
+  Item item;
+  item.type = kItemFrame;
+  item.page = nullptr;
+  item.startTime = startTime;
+  item.duration = duration;
+  item.color = color;
+  Queue(item);
+}
+
+void StreamWriter::AddPage(uint32_t threadIndex, bool events, uint32_t recordSize, MemoryPager::Page* page, uint32_t readOffset, uint32_t writeOffset)
+{
+  Item item;
+  item.type = events ? kItemEvents : kItemTokens;
+  item.threadIndex = threadIndex;
+  item.page = page;
+  item.readOffset = readOffset;
+  item.writeOffset = writeOffset;
+  item.recordSize = recordSize;
+
+  m_queuedPages.fetch_add(1, std::memory_order_relaxed);
+  Queue(item);
+}
+
+void StreamWriter::Queue(const Item& item)
+{
+  // The writer wakes up by itself, notifying for every item would just add overhead to the frame thread
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_queue.push_back(item);
+}
+
+void StreamWriter::Run()
+{
+  std::vector<Item> items;
+  bool stopping = false;
+
+  while (!stopping)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_condition.wait_for(lock, std::chrono::milliseconds(50), [this] { return m_stop; });
+
+      // Take everything that's queued, so the frame thread never waits on the file
+      items.swap(m_queue);
+      stopping = m_stop;
+    }
+
+    WriteItems(items);
+    items.clear();
+
+    WriteOpenEvents(stopping);
+    m_bytesWritten.store(m_file.GetBytesWritten(), std::memory_order_relaxed);
+  }
+
+  m_file.WriteCaptureTime(Timer::Now());
+  m_file.Close();
+  m_bytesWritten.store(m_file.GetBytesWritten(), std::memory_order_relaxed);
+}
+
+void StreamWriter::WriteItems(std::vector<Item>& items)
+{
+  // Names used by the queued pages were registered before the pages got queued
+  m_file.WriteNewNames();
+
+  // All frames of a batch go into one block
+  bool hasFrames = false;
+  for (auto it = items.begin(); it != items.end(); it++)
+  {
+    if (it->type != kItemFrame)
+      continue;
+
+    if (!hasFrames)
+      m_file.BeginFrames();
+    hasFrames = true;
+    m_file.WriteFrame(it->startTime, it->duration, it->color);
+  }
+  if (hasFrames)
+    m_file.EndFrames();
+
+  for (auto it = items.begin(); it != items.end(); it++)
+  {
+    switch (it->type)
+    {
+    case kItemThread:
+      m_file.WriteThread(it->threadIndex, it->threadID, it->threadName);
+      break;
+    case kItemEvents:
+      WriteEventPage(*it);
+      break;
+    case kItemTokens:
+      WriteTokenPage(*it);
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+void StreamWriter::WriteEventPage(const Item& item)
+{
+  m_file.BeginEvents(item.threadIndex);
+  for (uint32_t offset = item.readOffset; offset < item.writeOffset; offset += item.recordSize)
+  {
+    ProfilerEventManager::ProfilerEvent* ev = reinterpret_cast<ProfilerEventManager::ProfilerEvent*>(item.page->bufferStart + offset);
+    unsigned long long duration = ev->duration.load(std::memory_order_acquire);
+
+    // Events that are still running get written once they end
+    if (duration == ProfilerEventManager::kOpenEventDuration)
+    {
+      MemoryPager::Get()->RetainPage(item.page);
+      OpenEvent openEvent = { item.threadIndex, item.page, offset };
+      m_openEvents.push_back(openEvent);
+      continue;
+    }
+
+    if (duration != 0)
+      m_file.WriteEvent(ev->startTime, duration, ev->nameID, ev->depth);
+  }
+  m_file.EndEvents();
+
+  MemoryPager::Get()->ReleasePage(item.page);
+  m_queuedPages.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void StreamWriter::WriteTokenPage(const Item& item)
+{
+  m_file.BeginTokens(item.threadIndex);
+  for (uint32_t offset = item.readOffset; offset < item.writeOffset; offset += sizeof(ProfilerEventManager::StreamToken))
+  {
+    const ProfilerEventManager::StreamToken* token = reinterpret_cast<const ProfilerEventManager::StreamToken*>(item.page->bufferStart + offset);
+    m_file.WriteToken(token->timestamp, token->nameID, token->depth, token->type == ProfilerEventManager::kTokenEnd);
+  }
+  m_file.EndTokens();
+
+  MemoryPager::Get()->ReleasePage(item.page);
+  m_queuedPages.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void StreamWriter::WriteOpenEvents(bool stopping)
+{
+  // Events still running when streaming stops end at the stop time
+  unsigned long long stopTime = Timer::Now();
+
+  for (size_t i = 0; i < m_openEvents.size();)
+  {
+    OpenEvent &openEvent = m_openEvents[i];
+    ProfilerEventManager::ProfilerEvent* ev = reinterpret_cast<ProfilerEventManager::ProfilerEvent*>(openEvent.page->bufferStart + openEvent.offset);
+    unsigned long long duration = ev->duration.load(std::memory_order_acquire);
+
+    if (duration == ProfilerEventManager::kOpenEventDuration)
+    {
+      if (!stopping)
+      {
+        i++;
+        continue;
+      }
+      duration = stopTime > ev->startTime ? stopTime - ev->startTime : 0;
+    }
+
+    if (duration != 0)
+    {
+      m_file.BeginEvents(openEvent.threadIndex);
+      m_file.WriteEvent(ev->startTime, duration, ev->nameID, ev->depth);
+      m_file.EndEvents();
+    }
+
+    MemoryPager::Get()->ReleasePage(openEvent.page);
+    m_openEvents[i] = m_openEvents.back();
+    m_openEvents.pop_back();
+  }
+}
@@ -0,0 +1,87 @@
+#ifndef _STREAM_WRITER_H
+#define _STREAM_WRITER_H
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <string>
+#include "MemoryPager.h"
+#include "CaptureFile.h"
+
+/*
+* Appends recorded pages to a capture file on a background thread, so recordings aren't limited
+* to the profiler's history window. The frame thread queues pages, the writer thread encodes
+* them in batches and releases them once they're written
+*/
+class StreamWriter
+{
+public:
+  StreamWriter();
+  ~StreamWriter();
+
+  bool Start(const char* path);
+  void Stop(); // writes everything that's queued, then closes the file
+
+  bool IsRunning() { return m_thread.joinable(); }
+  const char* GetPath() { return m_path.c_str(); }
+  unsigned long long GetBytesWritten() { return m_bytesWritten.load(std::memory_order_relaxed); }
+  uint32_t GetQueuedPages() { return m_queuedPages.load(std::memory_order_relaxed); }
+
+  // Queue data for the writer thread, only called from the frame thread
+  void AddThread(uint32_t threadIndex, uint32_t threadID, const char* name);
+  void AddFrame(unsigned long long startTime, unsigned long long duration, uint32_t color);
+  // Takes over a reference to the page, events is true for ProfilerEvent records and false for StreamTokens.
+  // recordSize is the stride of the records, counter records only get their ProfilerEvent written
+  void AddPage(uint32_t threadIndex, bool events, uint32_t recordSize, MemoryPager::Page* page, uint32_t readOffset, uint32_t writeOffset);
+
+private:
+  enum ItemType { kItemThread, kItemFrame, kItemEvents, kItemTokens };
+
+  struct Item
+  {
+    ItemType type;
+    uint32_t threadIndex;
+    uint32_t threadID;
+    MemoryPager::Page* page;
+    uint32_t readOffset;
+    uint32_t writeOffset;
+    uint32_t recordSize;
+    unsigned long long startTime;
+    unsigned long long duration;
+    uint32_t color;
+    char threadName[64];
+  };
+
+  // Event that was still running when its page got written, the writer keeps a page reference until it ends
+  struct OpenEvent
+  {
+    uint32_t threadIndex;
+    MemoryPager::Page* page;
+    uint32_t offset;
+  };
+
+  void Run();
+  void Queue(const Item& item);
+  void WriteItems(std::vector<Item>& items);
+  void WriteEventPage(const Item& item);
+  void WriteTokenPage(const Item& item);
+  void WriteOpenEvents(bool stopping);
+
+  // Owned by the writer thread
+  CaptureFileWriter m_file;
+  std::vector<OpenEvent> m_openEvents;
+
+  std::thread m_thread;
+  std::string m_path;
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::vector<Item> m_queue;  // guarded by m_mutex
+  bool m_stop;                // guarded by m_mutex
+
+  std::atomic<unsigned long long> m_bytesWritten;
+  std::atomic<uint32_t> m_queuedPages;
+};
+
+#endif
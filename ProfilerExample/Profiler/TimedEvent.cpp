@@ -1,14 +1,21 @@
 #include "TimedEvent.h"
 #include "Profiler.h"
 
+std::atomic<bool> TimedEvent::s_captureEnabled(true);
+
 TimedEvent::TimedEvent(uint32_t color, const char* name)
+	: m_active(IsCaptureEnabled())
+{
+	if (m_active)
+		Profiler::Get()->BeginEvent(color, name);
+}
+
+void TimedEvent::Begin(uint32_t nameID)
 {
-	ProfilerEventManager::ProfilerEvent* ev = Profiler::Get()->BeginEvent(color, name);
-	timer.Start(&ev->startTime, &ev->duration);
+	Profiler::Get()->BeginEvent(nameID);
 }
 
-TimedEvent::~TimedEvent()
+void TimedEvent::End()
 {
-	timer.End();
 	Profiler::Get()->EndEvent();
 }
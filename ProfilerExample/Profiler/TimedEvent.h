@@ -1,23 +1,58 @@
 #ifndef _TIMEDEVENT_H
 #define _TIMEDEVENT_H
 #include "Timer.h"
+#include "NameRegistry.h"
+#include "AllocationTracker.h"
+#include <atomic>
+
+// Define PROFILER_ENABLED as 0 to compile all event macros out
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
 
 struct TimedEvent;
 
-#define SCOPED_EVENT(name) TimedEvent name(0, #name)
-#define SCOPED_EVENT_COLORED(name, color) TimedEvent name(color, #name)
+#if PROFILER_ENABLED
+// Each call site registers its name once, the first time it's recorded. Events then only carry the name ID
+#define SCOPED_EVENT(name) TimedEvent name(TimedEvent::kLazyName, [&] { static const uint32_t nameID = NameRegistry::Get()->Register(#name, 0); return nameID; })
+#define SCOPED_EVENT_COLORED(name, color) TimedEvent name(TimedEvent::kLazyName, [&] { static const uint32_t nameID = NameRegistry::Get()->Register(#name, color); return nameID; })
 
 #define EVENT_START(name) {	\
-														TimedEvent name(0, #name)
+														TimedEvent name(TimedEvent::kLazyName, [&] { static const uint32_t nameID = NameRegistry::Get()->Register(#name, 0); return nameID; })
+#define EVENT_END() }
+
+// Call from the application's allocator, only does anything while the AllocationTracker is enabled
+#define PROFILER_ALLOC(address, size) AllocationTracker::Get()->OnAlloc(address, size)
+#define PROFILER_FREE(address) AllocationTracker::Get()->OnFree(address)
+#else
+#define SCOPED_EVENT(name)
+#define SCOPED_EVENT_COLORED(name, color)
+#define EVENT_START(name) {
 #define EVENT_END() }
+#define PROFILER_ALLOC(address, size)
+#define PROFILER_FREE(address)
+#endif
 
 struct TimedEvent
 {
-	TimedEvent(uint32_t color, const char* name);
-	~TimedEvent();
+	// While capturing is off events cost a single branch, the event remembers the flag so begin and end always match
+	TimedEvent(uint32_t nameID) : m_active(IsCaptureEnabled()) { if (m_active) Begin(nameID); }
+	// Used by the macros, the name is only looked up while capturing so disabled scopes skip the static's init guard
+	enum LazyName { kLazyName };
+	template <typename GetNameID>
+	TimedEvent(LazyName, const GetNameID& getNameID) : m_active(IsCaptureEnabled()) { if (m_active) Begin(getNameID()); }
+	TimedEvent(uint32_t color, const char* name); // registers the name on every call, prefer the macros
+	~TimedEvent() { if (m_active) End(); }
+
+	static bool IsCaptureEnabled() { return s_captureEnabled.load(std::memory_order_relaxed); }
+	static void SetCaptureEnabled(bool enabled) { s_captureEnabled.store(enabled, std::memory_order_relaxed); }
 
 private:
-	Timer timer;
+	static void Begin(uint32_t nameID);
+	static void End();
+
+	static std::atomic<bool> s_captureEnabled;
+	bool m_active;
 };
 
-#endif
\ No newline at end of file
+#endif
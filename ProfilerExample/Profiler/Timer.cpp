@@ -1,3 +1,73 @@
 #include "Timer.h"
+#if TIMER_HAS_TSC && !defined(_MSC_VER)
+#include <cpuid.h>
+#endif
 
-std::chrono::high_resolution_clock::time_point Timer::globalStartTime;
\ No newline at end of file
+bool Timer::s_useTSC = false;
+bool Timer::s_useRDTSCP = false;
+unsigned long long Timer::s_globalStartTicks = 0;
+double Timer::s_nsPerTick = 1.0;
+double Timer::s_ticksPerNs = 1.0;
+
+bool Timer::IsInvariantTSC(bool* aHasRDTSCP)
+{
+	*aHasRDTSCP = false;
+
+#if TIMER_HAS_TSC
+	unsigned int regs[4] = {}; // eax, ebx, ecx, edx
+#ifdef _MSC_VER
+	__cpuid((int*)regs, 0x80000000);
+#else
+	__cpuid(0x80000000, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	unsigned int maxExtendedLeaf = regs[0];
+	if (maxExtendedLeaf < 0x80000007)
+		return false;
+
+	// RDTSCP support is bit 27 of edx in leaf 0x80000001
+#ifdef _MSC_VER
+	__cpuid((int*)regs, 0x80000001);
+#else
+	__cpuid(0x80000001, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	*aHasRDTSCP = (regs[3] & (1u << 27)) != 0;
+
+	// Invariant TSC is bit 8 of edx in leaf 0x80000007
+#ifdef _MSC_VER
+	__cpuid((int*)regs, 0x80000007);
+#else
+	__cpuid(0x80000007, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	return (regs[3] & (1u << 8)) != 0;
+#else
+	return false;
+#endif
+}
+
+void Timer::Init(ClockSource source)
+{
+	bool hasRDTSCP = false;
+	s_useTSC = source != kClockSteady && IsInvariantTSC(&hasRDTSCP);
+	s_useRDTSCP = s_useTSC && hasRDTSCP;
+	s_globalStartTicks = 0;
+	s_nsPerTick = s_ticksPerNs = 1.0;
+
+#if TIMER_HAS_TSC
+	if (s_useTSC)
+	{
+		// Calibrate ticks against steady_clock over a short busy wait
+		unsigned long long steadyStart = SteadyNow();
+		unsigned long long tscStart = __rdtsc();
+		while (SteadyNow() - steadyStart < 10000000) // 10 ms
+			;
+		unsigned long long steadyEnd = SteadyNow();
+		unsigned long long tscEnd = __rdtsc();
+
+		s_ticksPerNs = (double)(tscEnd - tscStart) / (double)(steadyEnd - steadyStart);
+		s_nsPerTick = 1.0 / s_ticksPerNs;
+	}
+#endif
+
+	// All timestamps are relative to this point
+	s_globalStartTicks = Now();
+}
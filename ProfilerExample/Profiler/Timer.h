@@ -2,36 +2,67 @@
 #define _TIMER_H
 #include <chrono>
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TIMER_HAS_TSC 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#else
+#define TIMER_HAS_TSC 0
+#endif
+
+// Clock used for all profiler timestamps
+// Timestamps are stored in raw ticks of the selected clock, and only converted to nanoseconds for display
 struct Timer
 {
-	void Start(unsigned long long* aStartTime, unsigned long long* aDuration)
+	enum ClockSource
 	{
-		startTime = aStartTime;
-		duration = aDuration;
+		kClockAuto = 0,	// TSC if it's invariant, steady_clock otherwise
+		kClockTSC,			// falls back to steady_clock if the TSC isn't invariant
+		kClockSteady
+	};
 
-		start = std::chrono::high_resolution_clock::now();
-		*startTime = (start - globalStartTime).count();
-	}
+	// Picks the clock source and calibrates the tick to nanosecond conversion, call once at startup
+	static void Init(ClockSource source = kClockAuto);
 
-	void End()
+	// Ticks since Init
+	static unsigned long long Now()
 	{
-		std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
-		auto elaps = end - start;
-		*duration = (elaps).count();
+#if TIMER_HAS_TSC
+		if (s_useTSC)
+			return __rdtsc() - s_globalStartTicks;
+#endif
+		return SteadyNow() - s_globalStartTicks;
 	}
 
-	static void Init() { globalStartTime = std::chrono::high_resolution_clock::now(); }
-	static std::chrono::high_resolution_clock::time_point GetGlobalStartTime() { return globalStartTime; }
+	// Same as Now, but waits for preceding instructions to finish when the TSC supports it
+	static unsigned long long NowSerialized()
+	{
+#if TIMER_HAS_TSC
+		if (s_useRDTSCP)
+		{
+			unsigned int aux;
+			return __rdtscp(&aux) - s_globalStartTicks;
+		}
+#endif
+		return Now();
+	}
 
-	// Pointer to start and end times
-	unsigned long long* startTime;
-	unsigned long long* duration;
+	static double TicksToNs(unsigned long long ticks) { return ticks * s_nsPerTick; }
+	static unsigned long long NsToTicks(double ns) { return (unsigned long long)(ns * s_ticksPerNs); }
+	static bool IsUsingTSC() { return s_useTSC; }
 
-	// Clock to track times
-	std::chrono::high_resolution_clock::time_point start;
+private:
+	static unsigned long long SteadyNow() { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+	static bool IsInvariantTSC(bool* aHasRDTSCP);
 
-	// TODO - remove this
-	static std::chrono::high_resolution_clock::time_point globalStartTime;
+	static bool s_useTSC;
+	static bool s_useRDTSCP;
+	static unsigned long long s_globalStartTicks;
+	static double s_nsPerTick;
+	static double s_ticksPerNs;
 };
 
-#endif
\ No newline at end of file
+#endif
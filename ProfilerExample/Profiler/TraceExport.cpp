@@ -0,0 +1,469 @@
+#include <string.h>
+#include "TraceExport.h"
+#include "NameRegistry.h"
+
+//******************************************************
+//                Trace Writer
+//******************************************************
+TraceWriter* TraceWriter::Create(Format format, const char* path)
+{
+  TraceWriter* writer = nullptr;
+  if (format == kPerfetto)
+    writer = new PerfettoTraceWriter();
+  else
+    writer = new ChromeTraceWriter();
+
+  if (!writer->Open(path))
+  {
+    delete writer;
+    return nullptr;
+  }
+  return writer;
+}
+
+TraceWriter::TraceWriter() : m_file(nullptr), m_buffer(kBufferSize), m_used(0), m_incomplete(false)
+{
+}
+
+TraceWriter::~TraceWriter()
+{
+  if (m_file != nullptr)
+    fclose(m_file);
+}
+
+bool TraceWriter::Open(const char* path)
+{
+#ifdef _MSC_VER
+  if (fopen_s(&m_file, path, "wb") != 0)
+    m_file = nullptr;
+#else
+  m_file = fopen(path, "wb");
+#endif
+  return m_file != nullptr;
+}
+
+bool TraceWriter::Close()
+{
+  if (m_file == nullptr)
+    return false;
+
+  Finish();
+  Flush();
+
+  bool success = ferror(m_file) == 0 && !m_incomplete;
+  success &= fclose(m_file) == 0;
+  m_file = nullptr;
+  return success;
+}
+
+void TraceWriter::Flush()
+{
+  if (m_used > 0)
+    fwrite(m_buffer.data(), 1, m_used, m_file);
+  m_used = 0;
+}
+
+void TraceWriter::Append(const void* data, size_t size)
+{
+  // Data larger than the buffer goes straight to the file
+  if (size > kBufferSize)
+  {
+    Flush();
+    fwrite(data, 1, size, m_file);
+    return;
+  }
+
+  memcpy(m_buffer.data() + m_used, data, size);
+  m_used += size;
+}
+
+void TraceWriter::AppendDecimal(unsigned long long value)
+{
+  char digits[20];
+  int count = 0;
+  do
+  {
+    digits[count++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+
+  while (count > 0)
+    Append(digits[--count]);
+}
+
+//******************************************************
+//                Chrome Trace Writer
+//******************************************************
+ChromeTraceWriter::ChromeTraceWriter() : m_tid(0), m_firstEvent(true)
+{
+}
+
+void ChromeTraceWriter::BeginTrack(uint32_t trackIndex, const char* name, uint32_t /*threadID*/)
+{
+  // Thread ids can be reused by the OS, so tracks get their own tid
+  m_tid = trackIndex + 1;
+
+  static const char kThreadName[] = "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":";
+  BeginEvent();
+  Reserve(sizeof(kThreadName) + 32);
+  Append(kThreadName, sizeof(kThreadName) - 1);
+  AppendDecimal(m_tid);
+  Append(",\"args\":{\"name\":", 16);
+  AppendEscaped(name);
+  Reserve(4);
+  Append("}}", 2);
+}
+
+void ChromeTraceWriter::WriteSlice(unsigned long long startTime, unsigned long long duration, uint32_t nameID, uint32_t /*depth*/)
+{
+  WriteCompleteEvent(GetName(nameID), startTime, duration);
+}
+
+void ChromeTraceWriter::WriteFrame(unsigned long long startTime, unsigned long long duration)
+{
+  static const std::string kFrameName("\"Frame\"");
+  WriteCompleteEvent(kFrameName, startTime, duration);
+}
+
+void ChromeTraceWriter::WriteCompleteEvent(const std::string& name, unsigned long long startTime, unsigned long long duration)
+{
+  BeginEvent();
+  Reserve(name.size() + 128);
+  Append("{\"name\":", 8);
+  Append(name.data(), name.size());
+  Append(",\"ph\":\"X\",\"pid\":1,\"tid\":", 24);
+  AppendDecimal(m_tid);
+  Append(",\"ts\":", 6);
+  AppendMicroseconds(startTime);
+  Append(",\"dur\":", 7);
+  AppendMicroseconds(duration);
+  Append('}');
+}
+
+void ChromeTraceWriter::Finish()
+{
+  if (m_firstEvent)
+  {
+    Reserve(16);
+    Append("{\"traceEvents\":[", 16);
+  }
+
+  static const char kFooter[] = "\n],\"displayTimeUnit\":\"ns\"}\n";
+  Reserve(sizeof(kFooter));
+  Append(kFooter, sizeof(kFooter) - 1);
+}
+
+void ChromeTraceWriter::BeginEvent()
+{
+  Reserve(20);
+  if (m_firstEvent)
+    Append("{\"traceEvents\":[\n", 17);
+  else
+    Append(",\n", 2);
+  m_firstEvent = false;
+}
+
+void ChromeTraceWriter::AppendMicroseconds(unsigned long long ns)
+{
+  AppendDecimal(ns / 1000);
+
+  unsigned long long fraction = ns % 1000;
+  if (fraction != 0)
+  {
+    Append('.');
+    Append((char)('0' + fraction / 100));
+    Append((char)('0' + fraction / 10 % 10));
+    Append((char)('0' + fraction % 10));
+  }
+}
+
+void ChromeTraceWriter::AppendEscaped(const char* str)
+{
+  std::string escaped = Escape(str);
+  Reserve(escaped.size());
+  Append(escaped.data(), escaped.size());
+}
+
+std::string ChromeTraceWriter::Escape(const char* str)
+{
+  std::string escaped("\"");
+  for (const char* c = str; *c != 0; c++)
+  {
+    if (*c == '"' || *c == '\\')
+    {
+      escaped += '\\';
+      escaped += *c;
+    }
+    else if ((unsigned char)*c < 0x20)
+    {
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", (unsigned char)*c);
+      escaped += code;
+    }
+    else
+      escaped += *c;
+  }
+  escaped += '"';
+  return escaped;
+}
+
+const std::string& ChromeTraceWriter::GetName(uint32_t nameID)
+{
+  // Names are escaped once and reused for every event with the same ID
+  if (nameID >= m_names.size())
+    m_names.resize(nameID + 1);
+
+  std::string& name = m_names[nameID];
+  if (name.empty())
+    name = Escape(NameRegistry::Get()->GetName(nameID));
+  return name;
+}
+
+//******************************************************
+//                Perfetto Trace Writer
+//******************************************************
+namespace
+{
+  // Field numbers from perfetto/protos/perfetto/trace
+  enum TraceField : uint32_t
+  {
+    kTracePacket = 1,
+
+    kPacketTimestamp = 8,
+    kPacketSequenceID = 10,
+    kPacketTrackEvent = 11,
+    kPacketInternedData = 12,
+    kPacketSequenceFlags = 13,
+    kPacketTrackDescriptor = 60,
+
+    kTrackUuid = 1,
+    kTrackName = 2,
+    kTrackProcess = 3,
+    kTrackThread = 4,
+
+    kProcessPid = 1,
+    kProcessName = 6,
+
+    kThreadPid = 1,
+    kThreadTid = 2,
+    kThreadName = 5,
+
+    kEventType = 9,
+    kEventNameIid = 10,
+    kEventTrackUuid = 11,
+    kEventName = 23,
+
+    kInternedEventNames = 2,
+    kInternedNameIid = 1,
+    kInternedNameName = 2,
+  };
+
+  enum : uint32_t
+  {
+    kSliceBegin = 1,
+    kSliceEnd = 2,
+
+    kIncrementalStateCleared = 1,
+    kNeedsIncrementalState = 2,
+
+    kPid = 1,
+    kProcessTrackUuid = 1,
+  };
+}
+
+PerfettoTraceWriter::PerfettoTraceWriter() : m_trackUuid(0), m_sequenceID(0)
+{
+}
+
+void PerfettoTraceWriter::BeginTrack(uint32_t trackIndex, const char* name, uint32_t threadID)
+{
+  // All tracks belong to a single process, described before the first track
+  if (m_sequenceID == 0)
+  {
+    ProtoMessage process;
+    process.VarintField(kProcessPid, kPid);
+    process.BytesField(kProcessName, "Profiler capture", 16);
+
+    m_message.Clear();
+    m_message.VarintField(kTrackUuid, kProcessTrackUuid);
+    m_message.MessageField(kTrackProcess, process);
+
+    m_packet.Clear();
+    m_packet.VarintField(kPacketSequenceID, 1);
+    m_packet.MessageField(kPacketTrackDescriptor, m_message);
+    WritePacket();
+  }
+
+  // Every track gets its own sequence, so name interning is per track
+  m_trackUuid = kProcessTrackUuid + 1 + trackIndex;
+  m_sequenceID = 2 + trackIndex;
+  m_internedNames.clear();
+
+  size_t nameLength = strlen(name);
+  ProtoMessage thread;
+  thread.VarintField(kThreadPid, kPid);
+  thread.VarintField(kThreadTid, trackIndex + 1); // thread ids can be reused by the OS
+  thread.BytesField(kThreadName, name, nameLength);
+
+  m_message.Clear();
+  m_message.VarintField(kTrackUuid, m_trackUuid);
+  if (threadID != 0 || nameLength == 0)
+    m_message.MessageField(kTrackThread, thread);
+  else
+    m_message.BytesField(kTrackName, name, nameLength); // not a thread, e.g. the frame timeline
+
+  m_packet.Clear();
+  m_packet.VarintField(kPacketSequenceID, m_sequenceID);
+  m_packet.VarintField(kPacketSequenceFlags, kIncrementalStateCleared);
+  m_packet.MessageField(kPacketTrackDescriptor, m_message);
+  WritePacket();
+}
+
+void PerfettoTraceWriter::WriteSlice(unsigned long long startTime, unsigned long long duration, uint32_t nameID, uint32_t depth)
+{
+  EndSlices(depth);
+  while (!m_openSlices.empty() && m_openSlices.back().endTime <= startTime)
+  {
+    WriteSliceEnd(m_openSlices.back().endTime);
+    m_openSlices.pop_back();
+  }
+
+  // Children can't outlive their parent, which rounding could cause
+  unsigned long long endTime = startTime + duration;
+  if (!m_openSlices.empty() && endTime > m_openSlices.back().endTime)
+    endTime = m_openSlices.back().endTime;
+
+  WriteSliceBegin(startTime, nameID);
+  OpenSlice slice = { endTime, depth };
+  m_openSlices.push_back(slice);
+}
+
+void PerfettoTraceWriter::WriteFrame(unsigned long long startTime, unsigned long long duration)
+{
+  EndSlices(0);
+
+  m_message.Clear();
+  m_message.VarintField(kEventType, kSliceBegin);
+  m_message.VarintField(kEventTrackUuid, m_trackUuid);
+  m_message.BytesField(kEventName, "Frame", 5);
+
+  BeginPacket(startTime);
+  m_packet.MessageField(kPacketTrackEvent, m_message);
+  WritePacket();
+
+  WriteSliceEnd(startTime + duration);
+}
+
+void PerfettoTraceWriter::EndTrack()
+{
+  EndSlices(0);
+}
+
+void PerfettoTraceWriter::EndSlices(uint32_t depth)
+{
+  while (!m_openSlices.empty() && m_openSlices.back().depth >= depth)
+  {
+    WriteSliceEnd(m_openSlices.back().endTime);
+    m_openSlices.pop_back();
+  }
+}
+
+void PerfettoTraceWriter::WriteSliceBegin(unsigned long long time, uint32_t nameID)
+{
+  BeginPacket(time);
+
+  // Names are sent once per sequence, later events refer to them by iid. Iids can't be 0
+  uint64_t iid = (uint64_t)nameID + 1;
+  if (nameID >= m_internedNames.size())
+    m_internedNames.resize(nameID + 1, false);
+  if (!m_internedNames[nameID])
+  {
+    const char* name = NameRegistry::Get()->GetName(nameID);
+
+    ProtoMessage eventName;
+    eventName.VarintField(kInternedNameIid, iid);
+    eventName.BytesField(kInternedNameName, name, strlen(name));
+
+    m_message.Clear();
+    m_message.MessageField(kInternedEventNames, eventName);
+    m_packet.MessageField(kPacketInternedData, m_message);
+    m_internedNames[nameID] = true;
+  }
+
+  m_message.Clear();
+  m_message.VarintField(kEventType, kSliceBegin);
+  m_message.VarintField(kEventTrackUuid, m_trackUuid);
+  m_message.VarintField(kEventNameIid, iid);
+  m_packet.MessageField(kPacketTrackEvent, m_message);
+
+  WritePacket();
+}
+
+void PerfettoTraceWriter::WriteSliceEnd(unsigned long long time)
+{
+  m_message.Clear();
+  m_message.VarintField(kEventType, kSliceEnd);
+  m_message.VarintField(kEventTrackUuid, m_trackUuid);
+
+  BeginPacket(time);
+  m_packet.MessageField(kPacketTrackEvent, m_message);
+  WritePacket();
+}
+
+void PerfettoTraceWriter::BeginPacket(unsigned long long time)
+{
+  m_packet.Clear();
+  m_packet.VarintField(kPacketTimestamp, time);
+  m_packet.VarintField(kPacketSequenceID, m_sequenceID);
+  m_packet.VarintField(kPacketSequenceFlags, kNeedsIncrementalState);
+}
+
+void PerfettoTraceWriter::WritePacket()
+{
+  // A truncated packet would corrupt the rest of the trace, so it's left out and Close reports it
+  if (m_packet.overflow)
+  {
+    m_incomplete = true;
+    return;
+  }
+
+  // The Trace message is just a list of packets, so it's written one field at a time
+  ProtoMessage header;
+  header.BytesField(kTracePacket, nullptr, m_packet.size);
+
+  Reserve(header.size + m_packet.size);
+  Append(header.data, header.size);
+  Append(m_packet.data, m_packet.size);
+}
+
+void PerfettoTraceWriter::ProtoMessage::Varint(uint64_t value)
+{
+  if (size + kMaxVarintSize > kMaxSize)
+  {
+    overflow = true;
+    return;
+  }
+
+  while (value >= 0x80)
+  {
+    data[size++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  data[size++] = (uint8_t)value;
+}
+
+void PerfettoTraceWriter::ProtoMessage::BytesField(uint32_t field, const void* bytes, size_t length)
+{
+  Tag(field, kLengthDelimited);
+  Varint(length);
+  if (bytes != nullptr)
+  {
+    if (overflow || length > kMaxSize - size)
+    {
+      overflow = true;
+      return;
+    }
+    memcpy(data + size, bytes, length);
+    size += (uint32_t)length;
+  }
+}
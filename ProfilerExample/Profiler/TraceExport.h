@@ -0,0 +1,148 @@
+#ifndef _TRACE_EXPORT_H
+#define _TRACE_EXPORT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "NameRegistry.h"
+
+/*
+* Streams captures into trace formats other tools can open (chrome://tracing, ui.perfetto.dev)
+* Output goes through a fixed size buffer, so exports never hold the whole document in memory
+*/
+class TraceWriter
+{
+public:
+  enum Format
+  {
+    kChromeJson = 0,  // Chrome Trace Event JSON
+    kPerfetto         // Perfetto protobuf trace
+  };
+
+  static const uint32_t kBufferSize = 1 << 20;
+  static const uint32_t kMaxNameLength = sizeof(NameRegistry::Entry::name) - 1; // longest event and thread names, in bytes
+
+  // Returns a writer for the format, or null if the file can't be created
+  static TraceWriter* Create(Format format, const char* path);
+
+  virtual ~TraceWriter();
+
+  // Tracks are threads or the frame timeline. Slices have to be written in start order per track,
+  // a track is finished before the next one starts. Times are in nanoseconds
+  virtual void BeginTrack(uint32_t trackIndex, const char* name, uint32_t threadID) = 0;
+  virtual void WriteSlice(unsigned long long startTime, unsigned long long duration, uint32_t nameID, uint32_t depth) = 0;
+  virtual void WriteFrame(unsigned long long startTime, unsigned long long duration) = 0;
+  virtual void EndTrack() = 0;
+
+  bool Close(); // returns false if any write failed or anything had to be left out
+
+protected:
+  TraceWriter();
+  bool Open(const char* path);
+  virtual void Finish() = 0; // writes whatever closes the document
+
+  void Flush();
+  void Reserve(size_t size) { if (m_used + size > kBufferSize) Flush(); }
+
+  // Unchecked appends, Reserve enough space first
+  void Append(char c) { m_buffer[m_used++] = c; }
+  void Append(const void* data, size_t size);
+  void AppendDecimal(unsigned long long value);
+
+  FILE* m_file;
+  std::vector<char> m_buffer;
+  size_t m_used;
+  bool m_incomplete; // set by writers that had to leave something out
+};
+
+class ChromeTraceWriter : public TraceWriter
+{
+public:
+  ChromeTraceWriter();
+
+  void BeginTrack(uint32_t trackIndex, const char* name, uint32_t threadID) override;
+  void WriteSlice(unsigned long long startTime, unsigned long long duration, uint32_t nameID, uint32_t depth) override;
+  void WriteFrame(unsigned long long startTime, unsigned long long duration) override;
+  void EndTrack() override {}
+
+private:
+  friend class TraceWriter;
+
+  void Finish() override;
+
+  void WriteCompleteEvent(const std::string& name, unsigned long long startTime, unsigned long long duration);
+  void BeginEvent();
+  void AppendMicroseconds(unsigned long long ns); // the format uses fractional microseconds
+  void AppendEscaped(const char* str);
+  static std::string Escape(const char* str); // quoted JSON string
+  const std::string& GetName(uint32_t nameID);
+
+  std::vector<std::string> m_names; // quoted and escaped names, per name ID
+  uint32_t m_tid;
+  bool m_firstEvent;
+};
+
+class PerfettoTraceWriter : public TraceWriter
+{
+public:
+  PerfettoTraceWriter();
+
+  void BeginTrack(uint32_t trackIndex, const char* name, uint32_t threadID) override;
+  void WriteSlice(unsigned long long startTime, unsigned long long duration, uint32_t nameID, uint32_t depth) override;
+  void WriteFrame(unsigned long long startTime, unsigned long long duration) override;
+  void EndTrack() override;
+
+private:
+  friend class TraceWriter;
+
+  // Protobuf wire format
+  enum WireType { kVarint = 0, kLengthDelimited = 2 };
+
+  // Small protobuf message built on the stack. Packets hold at most one name, the other fields of the biggest one
+  // (an event interning its name) take up less than 128 bytes
+  struct ProtoMessage
+  {
+    static const uint32_t kMaxSize = kMaxNameLength + 128;
+    static const uint32_t kMaxVarintSize = 10;
+
+    ProtoMessage() : size(0), overflow(false) {}
+
+    void Clear() { size = 0; overflow = false; }
+    void Varint(uint64_t value);
+    void Tag(uint32_t field, WireType type) { Varint((field << 3) | type); }
+    void VarintField(uint32_t field, uint64_t value) { Tag(field, kVarint); Varint(value); }
+    void BytesField(uint32_t field, const void* bytes, size_t length); // only writes the header if bytes is null
+    void MessageField(uint32_t field, const ProtoMessage& message) { overflow |= message.overflow; BytesField(field, message.data, message.size); }
+
+    uint8_t data[kMaxSize];
+    uint32_t size;
+    bool overflow; // a field didn't fit, the message is incomplete and must not be written
+  };
+
+  // Open slice on the current track, ended once a slice at the same or a lower depth starts
+  struct OpenSlice
+  {
+    unsigned long long endTime;
+    uint32_t depth;
+  };
+
+  void Finish() override {}
+
+  void WriteSliceBegin(unsigned long long time, uint32_t nameID);
+  void WriteSliceEnd(unsigned long long time);
+  void EndSlices(uint32_t depth);
+
+  // Packets are built in m_packet, then appended to the output as field 1 of the Trace message
+  void BeginPacket(unsigned long long time);
+  void WritePacket();
+
+  ProtoMessage m_packet;
+  ProtoMessage m_message; // scratch space for nested messages
+  std::vector<OpenSlice> m_openSlices;
+  std::vector<bool> m_internedNames; // names already interned on the current sequence
+  uint64_t m_trackUuid;
+  uint32_t m_sequenceID; // packet sequence of the current track, 0 before the first track
+};
+
+#endif
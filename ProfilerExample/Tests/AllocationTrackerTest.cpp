@@ -0,0 +1,60 @@
+#include "TestUtil.h"
+#include "AllocationTracker.h"
+#include "TimedEvent.h"
+#include "Timer.h"
+
+/*
+* Threads allocate and free while others look up addresses that were never allocated. Every allocation is sampled,
+* so each free of a tracked address has to find it even while removals move the slots around it, otherwise the
+* live bytes don't go back to zero
+*/
+
+static const uint32_t kNumThreads = 8;
+static const uint32_t kLivePerThread = 8192;
+static const uint32_t kAllocsPerThread = 100000;
+
+// The addresses are only used as keys, each thread gets its own range
+static void* MakeAddress(uint32_t thread, uint32_t index)
+{
+  return (void*)(uintptr_t)(((uint64_t)(thread + 1) << 40) | ((uint64_t)index << 4));
+}
+
+static void AllocAndFree(uint32_t thread)
+{
+  for (uint32_t i = 0; i < kAllocsPerThread; i++)
+  {
+    if (i >= kLivePerThread)
+      PROFILER_FREE(MakeAddress(thread, i - kLivePerThread));
+    PROFILER_ALLOC(MakeAddress(thread, i), 16 + i % 64);
+  }
+  for (uint32_t i = kAllocsPerThread - kLivePerThread; i < kAllocsPerThread; i++)
+    PROFILER_FREE(MakeAddress(thread, i));
+}
+
+static void FreeUntracked(uint32_t thread, std::atomic<uint32_t>& running)
+{
+  for (uint32_t i = 0; running.load(std::memory_order_acquire) > 0; i++)
+    PROFILER_FREE(MakeAddress(thread, i % kAllocsPerThread));
+}
+
+int main()
+{
+  Timer::Init();
+  Profiler* profiler = Profiler::Get();
+  profiler->SetHistoryTime(Profiler::kMinFrameTime);
+  AllocationTracker* tracker = AllocationTracker::Get();
+  tracker->Enable(0);
+
+  std::atomic<uint32_t> running(kNumThreads);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < kNumThreads; t++)
+    threads.emplace_back([t, &running] { AllocAndFree(t); running.fetch_sub(1, std::memory_order_release); });
+  for (uint32_t t = 0; t < 2; t++)
+    threads.emplace_back([t, &running] { FreeUntracked(kNumThreads + t, running); });
+  RunFramesUntilDone(threads, running);
+
+  TEST_CHECK(tracker->GetDroppedAllocations() == 0, "%u allocations didn't fit in the table", tracker->GetDroppedAllocations());
+  TEST_CHECK(tracker->GetLiveBytes() == 0, "%lld bytes are still live after everything was freed", tracker->GetLiveBytes());
+
+  return TestResult();
+}
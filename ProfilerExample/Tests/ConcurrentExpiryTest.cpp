@@ -0,0 +1,183 @@
+#include "TestUtil.h"
+#include "CaptureFile.h"
+#include "TimedEvent.h"
+#include "Timer.h"
+
+/*
+* Worker threads keep recording while the main thread expires their records every frame and streams full pages
+* to a file, without any locks between them. Build with -DPROFILER_SANITIZE_THREAD=ON to check the memory
+* ordering of the page offsets with ThreadSanitizer
+*/
+
+static const uint32_t kNumThreads = 8;
+static const uint32_t kScopesPerThread = 50000;
+static const char* kStreamPath = "ConcurrentExpiryTest.prcf";
+static const char* kCapturePath = "ConcurrentExpiryTestCapture.prcf";
+static const unsigned long long kLongHistoryTime = (unsigned long long)(200e6); // long enough to capture before it expires
+
+static void RecordScopes()
+{
+  for (uint32_t i = 0; i < kScopesPerThread; i++)
+  {
+    SCOPED_EVENT(ExpiryOuter);
+    {
+      SCOPED_EVENT(ExpiryMiddle);
+      if (i % 8 == 0)
+      {
+        SCOPED_EVENT(ExpiryInner);
+      }
+    }
+  }
+}
+
+// Without streaming the frame thread expires records from the pages that are still being written to.
+// While streaming, records only expire once they were streamed, which happens when a page is full
+static void TestFormat(ProfilerEventManager::RecordFormat format, bool stream, const char* name)
+{
+  Profiler* profiler = Profiler::Get();
+  profiler->SetRecordFormat(format);
+  if (stream)
+    TEST_CHECK(profiler->StartStreaming(kStreamPath), "%s: couldn't open %s", name, kStreamPath);
+
+  std::atomic<uint32_t> running(kNumThreads);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < kNumThreads; t++)
+    threads.emplace_back([&running] { RecordScopes(); running.fetch_sub(1, std::memory_order_release); });
+  uint32_t frames = RunFramesUntilDone(threads, running);
+  ExpireAllEvents();
+  TEST_CHECK(frames > 0, "%s: no frame ran while the threads were recording", name);
+  TEST_CHECK(profiler->GetNumManagers() == 0, "%s: %u event managers left after all threads exited", name, profiler->GetNumManagers());
+
+  // A torn read while streaming leaves a file the loader rejects
+  if (stream)
+  {
+    profiler->StopStreaming();
+    TEST_CHECK(profiler->LoadCapture(kStreamPath), "%s: the streamed capture doesn't load", name);
+    remove(kStreamPath);
+  }
+
+  printf("%s: %u pages allocated\n", name, MemoryPager::Get()->GetNumPages());
+}
+
+// Depth of the saved events with the given name, -1 if there are none or they don't agree
+static int GetSavedDepth(const char* path, const char* eventName)
+{
+  CaptureFileReader reader;
+  if (!reader.Open(path))
+    return -1;
+
+  uint32_t eventID = NameRegistry::kInvalidNameID;
+  int savedDepth = -1;
+  CaptureFileReader::Block block;
+  while (reader.NextBlock(block))
+  {
+    if (block.type == CaptureFile::kBlockNames)
+    {
+      uint32_t id, color;
+      std::string name;
+      while (CaptureFileReader::ReadName(block, id, color, name))
+        if (name == eventName)
+          eventID = id;
+    }
+    else if (block.type == CaptureFile::kBlockEvents)
+    {
+      uint32_t threadIndex, nameID, depth;
+      unsigned long long startTime, duration;
+      if (!CaptureFileReader::ReadEventThread(block, threadIndex))
+        continue;
+      while (CaptureFileReader::ReadEvent(block, startTime, duration, nameID, depth))
+      {
+        if (nameID != eventID)
+          continue;
+        if (savedDepth != -1 && savedDepth != (int)depth)
+          return -1;
+        savedDepth = (int)depth;
+      }
+    }
+  }
+  return savedDepth;
+}
+
+// The stream format rebuilds the nesting from tokens. Once the begin of an outer event expired, the events
+// recorded inside it still have to keep their depth, and its end must not close one of them
+static void TestExpiredOuterBegin()
+{
+  Profiler* profiler = Profiler::Get();
+  profiler->SetRecordFormat(ProfilerEventManager::kRecordStream);
+  profiler->SetHistoryTime(kLongHistoryTime);
+
+  std::atomic<uint32_t> step(0);
+  std::thread thread([&step]
+  {
+    SCOPED_EVENT(ExpiredOuter);
+    {
+      SCOPED_EVENT(ExpiredMiddle);
+      step.store(1, std::memory_order_release);
+      while (step.load(std::memory_order_acquire) != 2)
+        std::this_thread::yield();
+      SCOPED_EVENT(NestedInner);
+      {
+        SCOPED_EVENT(NestedLeaf);
+      }
+    }
+  });
+
+  // Both begin tokens expire before the thread records anything else
+  while (step.load(std::memory_order_acquire) != 1)
+    std::this_thread::yield();
+  std::this_thread::sleep_for(std::chrono::nanoseconds(kLongHistoryTime * 2));
+  profiler->BeginFrame();
+  profiler->EndFrame();
+  step.store(2, std::memory_order_release);
+  thread.join();
+
+  profiler->TakeCapture();
+  TEST_CHECK(profiler->SaveCapture(kCapturePath), "expired outer begin: couldn't save %s", kCapturePath);
+  int innerDepth = GetSavedDepth(kCapturePath, "NestedInner");
+  int leafDepth = GetSavedDepth(kCapturePath, "NestedLeaf");
+  TEST_CHECK(innerDepth == 2, "expired outer begin: the inner event is at depth %d instead of 2", innerDepth);
+  TEST_CHECK(leafDepth == 3, "expired outer begin: the leaf event is at depth %d instead of 3", leafDepth);
+  TEST_CHECK(GetSavedDepth(kCapturePath, "ExpiredMiddle") == -1, "expired outer begin: an event without a begin was captured");
+  remove(kCapturePath);
+
+  profiler->SetHistoryTime(Profiler::kMinFrameTime);
+  ExpireAllEvents();
+  TEST_CHECK(profiler->GetNumManagers() == 0, "expired outer begin: the manager wasn't deleted");
+}
+
+// A thread that exits inside a scope can't end it anymore, its manager ends it when it retires. Until then the
+// event would never show up in captures, and kRecordEvents would keep its page and the manager around
+static void TestExitInsideScope(ProfilerEventManager::RecordFormat format, const char* name)
+{
+  Profiler* profiler = Profiler::Get();
+  profiler->SetRecordFormat(format);
+  profiler->SetHistoryTime(kLongHistoryTime);
+
+  std::thread thread([] { Profiler::Get()->BeginEvent(0, "ExitedInside"); });
+  thread.join();
+
+  profiler->TakeCapture();
+  TEST_CHECK(profiler->SaveCapture(kCapturePath), "%s, exit inside a scope: couldn't save %s", name, kCapturePath);
+  TEST_CHECK(GetSavedDepth(kCapturePath, "ExitedInside") == 0, "%s, exit inside a scope: the event wasn't captured", name);
+  remove(kCapturePath);
+
+  profiler->SetHistoryTime(Profiler::kMinFrameTime);
+  ExpireAllEvents();
+  TEST_CHECK(profiler->GetNumManagers() == 0, "%s, exit inside a scope: the manager wasn't deleted", name);
+}
+
+int main()
+{
+  Timer::Init();
+  Profiler::Get()->SetHistoryTime(Profiler::kMinFrameTime);
+
+  TestFormat(ProfilerEventManager::kRecordEvents, false, "kRecordEvents");
+  TestFormat(ProfilerEventManager::kRecordStream, false, "kRecordStream");
+  TestFormat(ProfilerEventManager::kRecordEvents, true, "kRecordEvents, streaming");
+  TestFormat(ProfilerEventManager::kRecordStream, true, "kRecordStream, streaming");
+  TestExpiredOuterBegin();
+  TestExitInsideScope(ProfilerEventManager::kRecordEvents, "kRecordEvents");
+  TestExitInsideScope(ProfilerEventManager::kRecordStream, "kRecordStream");
+
+  return TestResult();
+}
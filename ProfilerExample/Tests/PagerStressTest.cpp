@@ -0,0 +1,127 @@
+#include <string.h>
+#include <algorithm>
+#include "TestUtil.h"
+#include "TimedEvent.h"
+#include "Timer.h"
+#include "MemoryPager.h"
+
+/*
+* 32 threads hammer the MemoryPager and SCOPED_EVENT while the main thread expires events every frame.
+* Afterwards every page has to be back in the pager exactly once: none lost, none handed out twice
+*/
+
+static const uint32_t kNumThreads = 32;
+static const uint32_t kPagerIterations = 20000;
+static const uint32_t kPagesPerIteration = 8; // more than the thread cache holds, so the shared free list gets used
+static const uint32_t kScopesPerThread = 100000;
+
+// Threads stamp the pages they own, a page handed out twice gets its stamp overwritten
+static void TestPagerOwnership()
+{
+  std::atomic<uint32_t> duplicates(0);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < kNumThreads; t++)
+  {
+    threads.emplace_back([t, &duplicates]
+    {
+      MemoryPager::Page* pages[kPagesPerIteration];
+      for (uint32_t i = 0; i < kPagerIterations; i++)
+      {
+        uint32_t stamp = (t << 24) | i;
+        for (uint32_t p = 0; p < kPagesPerIteration; p++)
+        {
+          pages[p] = MemoryPager::Get()->GetPage();
+          memcpy(pages[p]->bufferStart, &stamp, sizeof(stamp));
+        }
+        std::this_thread::yield();
+        for (uint32_t p = 0; p < kPagesPerIteration; p++)
+        {
+          uint32_t current;
+          memcpy(&current, pages[p]->bufferStart, sizeof(current));
+          if (current != stamp)
+            duplicates.fetch_add(1, std::memory_order_relaxed);
+          MemoryPager::Get()->ReleasePage(pages[p]);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  TEST_CHECK(duplicates.load() == 0, "%u pages were owned by two threads at once", duplicates.load());
+}
+
+// Constructed before the thread's first event, so it's destroyed after the thread's manager got retired
+struct LateRecorder
+{
+  ~LateRecorder()
+  {
+    SCOPED_EVENT(StressThreadExit);
+  }
+};
+
+static thread_local LateRecorder t_lateRecorder;
+
+static void RecordScopes()
+{
+  (void)t_lateRecorder;
+  for (uint32_t i = 0; i < kScopesPerThread; i++)
+  {
+    SCOPED_EVENT(StressOuter);
+    if (i % 4 == 0)
+    {
+      SCOPED_EVENT(StressInner);
+    }
+  }
+}
+
+// Events are recorded while the main thread keeps expiring them, like a frame loop with a short history
+static void TestScopedEvents()
+{
+  Profiler* profiler = Profiler::Get();
+  profiler->SetHistoryTime(Profiler::kMinFrameTime);
+
+  std::atomic<uint32_t> running(kNumThreads);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < kNumThreads; t++)
+    threads.emplace_back([&running] { RecordScopes(); running.fetch_sub(1, std::memory_order_release); });
+
+  RunFramesUntilDone(threads, running);
+  ExpireAllEvents();
+
+  // Events recorded while the threads exited must not have created new managers
+  TEST_CHECK(profiler->GetNumManagers() == 0, "%u event managers left after all threads exited", profiler->GetNumManagers());
+}
+
+// Draining the pager has to return every page it ever allocated exactly once without allocating new ones
+static void TestAllPagesReturned()
+{
+  uint32_t numPages = MemoryPager::Get()->GetNumPages();
+  std::vector<MemoryPager::Page*> pages;
+  for (uint32_t i = 0; i < numPages; i++)
+    pages.push_back(MemoryPager::Get()->GetPage());
+
+  TEST_CHECK(MemoryPager::Get()->GetNumPages() == numPages, "%u pages were lost", MemoryPager::Get()->GetNumPages() - numPages);
+
+  std::sort(pages.begin(), pages.end());
+  uint32_t duplicates = 0;
+  for (size_t i = 1; i < pages.size(); i++)
+    duplicates += pages[i] == pages[i - 1] ? 1 : 0;
+  TEST_CHECK(duplicates == 0, "%u pages were free more than once", duplicates);
+
+  for (auto page = pages.begin(); page != pages.end(); page++)
+    MemoryPager::Get()->ReleasePage(*page);
+
+  printf("%u pages allocated in total\n", numPages);
+}
+
+int main()
+{
+  Timer::Init();
+
+  TestPagerOwnership();
+  TestScopedEvents();
+  TestAllPagesReturned();
+
+  return TestResult();
+}
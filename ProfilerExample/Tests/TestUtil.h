@@ -0,0 +1,56 @@
+#ifndef _TEST_UTIL_H
+#define _TEST_UTIL_H
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "Profiler.h"
+
+/*
+* Shared harness of the tests: failed checks are printed and counted, main returns TestResult()
+*/
+
+static uint32_t g_failures = 0;
+
+#define TEST_CHECK(condition, ...) \
+  do { if (!(condition)) { printf("FAILED %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); g_failures++; } } while (0)
+
+// Exit code of the test
+inline int TestResult()
+{
+  if (g_failures > 0)
+  {
+    printf("%u checks failed\n", g_failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
+
+// Runs frames on this thread until running drops to 0, then joins the threads. Returns the number of frames
+inline uint32_t RunFramesUntilDone(std::vector<std::thread>& threads, std::atomic<uint32_t>& running)
+{
+  Profiler* profiler = Profiler::Get();
+  uint32_t frames = 0;
+  while (running.load(std::memory_order_acquire) > 0)
+  {
+    profiler->BeginFrame();
+    profiler->EndFrame();
+    frames++;
+  }
+  for (auto& thread : threads)
+    thread.join();
+  return frames;
+}
+
+// Lets everything recorded so far expire with a history of kMinFrameTime, exited threads' managers get deleted with it
+inline void ExpireAllEvents()
+{
+  std::this_thread::sleep_for(std::chrono::nanoseconds(Profiler::kMinFrameTime * 2));
+  Profiler::Get()->BeginFrame();
+  Profiler::Get()->EndFrame();
+}
+
+#endif
@@ -0,0 +1,490 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include "TestUtil.h"
+#include "TraceExport.h"
+#include "NameRegistry.h"
+
+/*
+* Exports a synthetic capture to both trace formats and reads the files back: the JSON has to parse with every
+* thread's events nesting inside each other, and every Perfetto packet has to be exactly as long as its length
+* prefix says, with begins and ends balanced per track
+*/
+
+static const char* kJsonPath = "TraceExportTest.json";
+static const char* kPerfettoPath = "TraceExportTest.perfetto-trace";
+static const uint32_t kNumThreads = 3;
+static const uint32_t kSlicesPerThread = 20000; // the JSON gets bigger than the writer's buffer
+
+// Slice as it's passed to the writers, in ns
+struct Slice
+{
+  unsigned long long startTime;
+  unsigned long long duration;
+  uint32_t nameID;
+  uint32_t depth;
+};
+
+struct Track
+{
+  std::string name;
+  uint32_t threadID;
+  std::vector<Slice> slices;
+};
+
+static std::vector<Track> MakeTracks()
+{
+  NameRegistry* names = NameRegistry::Get();
+  uint32_t outer = names->Register("ExportOuter", 0);
+  uint32_t inner = names->Register("Export \"inner\" \\ scope\n", 0);
+  uint32_t innermost = names->Register(std::string(TraceWriter::kMaxNameLength, 'n').c_str(), 0);
+
+  std::vector<Track> tracks;
+  for (uint32_t t = 0; t < kNumThreads; t++)
+  {
+    Track track;
+    track.name = t == 0 ? std::string("Main\tthread") : t == 1 ? std::string(TraceWriter::kMaxNameLength, 't') : std::string("Worker");
+    track.threadID = 100 + t;
+
+    // Outer scopes with two children, the first one with a child of its own, with fractional microseconds
+    unsigned long long time = 1000000 * (t + 1);
+    for (uint32_t i = 0; i + 4 <= kSlicesPerThread; i += 4)
+    {
+      Slice slices[] =
+      {
+        { time, 10001, outer, 0 },
+        { time + 1, 4000, inner, 1 },
+        { time + 2, 1500, innermost, 2 },
+        { time + 5000, 5001, inner, 1 },
+      };
+      track.slices.insert(track.slices.end(), slices, slices + 4);
+      time += 10001 + (i % 3);
+    }
+    tracks.push_back(track);
+  }
+  return tracks;
+}
+
+static bool Export(TraceWriter::Format format, const char* path, const std::vector<Track>& tracks)
+{
+  TraceWriter* writer = TraceWriter::Create(format, path);
+  if (writer == nullptr)
+    return false;
+
+  writer->BeginTrack(0, "Frames", 0);
+  for (uint32_t i = 0; i < 10; i++)
+    writer->WriteFrame(1000000ull * (i + 1), 999999);
+  writer->EndTrack();
+
+  for (uint32_t t = 0; t < tracks.size(); t++)
+  {
+    writer->BeginTrack(t + 1, tracks[t].name.c_str(), tracks[t].threadID);
+    for (auto it = tracks[t].slices.begin(); it != tracks[t].slices.end(); it++)
+      writer->WriteSlice(it->startTime, it->duration, it->nameID, it->depth);
+    writer->EndTrack();
+  }
+
+  bool success = writer->Close();
+  delete writer;
+  return success;
+}
+
+static bool ReadFile(const char* path, std::string& contents)
+{
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr)
+    return false;
+
+  char buffer[65536];
+  size_t count;
+  while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    contents.append(buffer, count);
+  fclose(file);
+  return true;
+}
+
+//******************************************************
+//                JSON
+//******************************************************
+
+// Just enough of a JSON parser to check the Chrome writer's output
+struct JsonValue
+{
+  enum Type { kNull, kBool, kNumber, kString, kArray, kObject };
+
+  JsonValue() : type(kNull), number(0) {}
+
+  const JsonValue* Find(const char* key) const
+  {
+    for (auto it = members.begin(); it != members.end(); it++)
+    {
+      if (it->first == key)
+        return &it->second;
+    }
+    return nullptr;
+  }
+
+  Type type;
+  double number; // also 0 / 1 for bools
+  std::string string;
+  std::vector<JsonValue> elements;
+  std::vector<std::pair<std::string, JsonValue>> members;
+};
+
+class JsonParser
+{
+public:
+  JsonParser(const std::string& text) : m_current(text.c_str()), m_end(text.c_str() + text.size()) {}
+
+  // The whole text has to be a single value
+  bool Parse(JsonValue& value)
+  {
+    if (!ParseValue(value, 0))
+      return false;
+    SkipWhitespace();
+    return m_current == m_end;
+  }
+
+private:
+  static const uint32_t kMaxNesting = 64;
+
+  void SkipWhitespace()
+  {
+    while (m_current < m_end && (*m_current == ' ' || *m_current == '\t' || *m_current == '\n' || *m_current == '\r'))
+      m_current++;
+  }
+
+  bool Consume(const char* literal)
+  {
+    size_t length = strlen(literal);
+    if ((size_t)(m_end - m_current) < length || memcmp(m_current, literal, length) != 0)
+      return false;
+    m_current += length;
+    return true;
+  }
+
+  bool ParseValue(JsonValue& value, uint32_t nesting)
+  {
+    SkipWhitespace();
+    if (m_current == m_end || nesting > kMaxNesting)
+      return false;
+
+    switch (*m_current)
+    {
+    case '{': value.type = JsonValue::kObject; return ParseObject(value, nesting);
+    case '[': value.type = JsonValue::kArray; return ParseArray(value, nesting);
+    case '"': value.type = JsonValue::kString; return ParseString(value.string);
+    case 't': value.type = JsonValue::kBool; value.number = 1; return Consume("true");
+    case 'f': value.type = JsonValue::kBool; return Consume("false");
+    case 'n': return Consume("null");
+    default: value.type = JsonValue::kNumber; return ParseNumber(value.number);
+    }
+  }
+
+  bool ParseObject(JsonValue& value, uint32_t nesting)
+  {
+    m_current++;
+    SkipWhitespace();
+    if (Consume("}"))
+      return true;
+
+    do
+    {
+      SkipWhitespace();
+      value.members.push_back(std::make_pair(std::string(), JsonValue()));
+      if (!ParseString(value.members.back().first))
+        return false;
+      SkipWhitespace();
+      if (!Consume(":") || !ParseValue(value.members.back().second, nesting + 1))
+        return false;
+      SkipWhitespace();
+    } while (Consume(","));
+    return Consume("}");
+  }
+
+  bool ParseArray(JsonValue& value, uint32_t nesting)
+  {
+    m_current++;
+    SkipWhitespace();
+    if (Consume("]"))
+      return true;
+
+    do
+    {
+      value.elements.push_back(JsonValue());
+      if (!ParseValue(value.elements.back(), nesting + 1))
+        return false;
+      SkipWhitespace();
+    } while (Consume(","));
+    return Consume("]");
+  }
+
+  bool ParseString(std::string& str)
+  {
+    if (!Consume("\""))
+      return false;
+
+    while (m_current < m_end && *m_current != '"')
+    {
+      char c = *m_current++;
+      if ((unsigned char)c < 0x20)
+        return false;
+      if (c != '\\')
+      {
+        str += c;
+        continue;
+      }
+
+      if (m_current == m_end)
+        return false;
+      c = *m_current++;
+      switch (c)
+      {
+      case '"': case '\\': case '/': str += c; break;
+      case 'b': str += '\b'; break;
+      case 'f': str += '\f'; break;
+      case 'n': str += '\n'; break;
+      case 'r': str += '\r'; break;
+      case 't': str += '\t'; break;
+      case 'u':
+      {
+        // The writer only escapes control characters, anything else doesn't need decoding
+        if (m_end - m_current < 4)
+          return false;
+        char hex[5] = { m_current[0], m_current[1], m_current[2], m_current[3], 0 };
+        char* hexEnd = nullptr;
+        unsigned long code = strtoul(hex, &hexEnd, 16);
+        if (hexEnd != hex + 4 || code >= 0x80)
+          return false;
+        str += (char)code;
+        m_current += 4;
+        break;
+      }
+      default:
+        return false;
+      }
+    }
+    return Consume("\"");
+  }
+
+  bool ParseNumber(double& number)
+  {
+    // strtod would accept more than JSON does, so the characters are checked first
+    const char* start = m_current;
+    if (m_current < m_end && *m_current == '-')
+      m_current++;
+    if (m_current == m_end || *m_current < '0' || *m_current > '9')
+      return false;
+    while (m_current < m_end && ((*m_current >= '0' && *m_current <= '9') || *m_current == '.' || *m_current == 'e' || *m_current == 'E' || *m_current == '+' || *m_current == '-'))
+      m_current++;
+
+    std::string digits(start, m_current);
+    char* end = nullptr;
+    number = strtod(digits.c_str(), &end);
+    return end == digits.c_str() + digits.size();
+  }
+
+  const char* m_current;
+  const char* m_end;
+};
+
+static void CheckChromeJson(const std::vector<Track>& tracks)
+{
+  std::string text;
+  TEST_CHECK(ReadFile(kJsonPath, text), "couldn't read %s", kJsonPath);
+
+  JsonValue root;
+  bool parsed = JsonParser(text).Parse(root);
+  TEST_CHECK(parsed, "%s doesn't parse", kJsonPath);
+  const JsonValue* events = root.Find("traceEvents");
+  TEST_CHECK(events != nullptr && events->type == JsonValue::kArray, "no traceEvents array");
+  if (!parsed || events == nullptr)
+    return;
+
+  // Complete events per tid, in microseconds like the file
+  struct Event { double start; double end; };
+  std::map<uint32_t, std::vector<Event>> threadEvents;
+  std::map<uint32_t, std::string> threadNames;
+  for (auto it = events->elements.begin(); it != events->elements.end(); it++)
+  {
+    const JsonValue* ph = it->Find("ph");
+    const JsonValue* tid = it->Find("tid");
+    if (ph == nullptr || tid == nullptr)
+    {
+      TEST_CHECK(false, "event without ph or tid");
+      continue;
+    }
+
+    if (ph->string == "M")
+    {
+      const JsonValue* args = it->Find("args");
+      const JsonValue* name = args != nullptr ? args->Find("name") : nullptr;
+      threadNames[(uint32_t)tid->number] = name != nullptr ? name->string : std::string();
+    }
+    else if (ph->string == "X")
+    {
+      const JsonValue* ts = it->Find("ts");
+      const JsonValue* dur = it->Find("dur");
+      TEST_CHECK(ts != nullptr && dur != nullptr && it->Find("name") != nullptr, "complete event without name, ts or dur");
+      if (ts != nullptr && dur != nullptr)
+        threadEvents[(uint32_t)tid->number].push_back({ ts->number, ts->number + dur->number });
+    }
+  }
+
+  TEST_CHECK(threadEvents.size() == tracks.size() + 1, "%u threads with events, expected %u", (uint32_t)threadEvents.size(), (uint32_t)tracks.size() + 1);
+  for (uint32_t t = 0; t < tracks.size(); t++)
+  {
+    uint32_t tid = t + 2; // the frame track is the first one
+    TEST_CHECK(threadNames[tid] == tracks[t].name, "thread %u is named \"%s\"", tid, threadNames[tid].c_str());
+    TEST_CHECK(threadEvents[tid].size() == tracks[t].slices.size(), "thread %u has %u events, %u were written", tid, (uint32_t)threadEvents[tid].size(), (uint32_t)tracks[t].slices.size());
+  }
+
+  // Every event has to end inside the events it started in, otherwise the viewer shows them unbalanced.
+  // Times have three decimals, the tolerance only covers adding them up as doubles
+  const double kTolerance = 1e-6;
+  for (auto thread = threadEvents.begin(); thread != threadEvents.end(); thread++)
+  {
+    uint32_t misnested = 0;
+    std::vector<double> openEnds;
+    for (auto it = thread->second.begin(); it != thread->second.end(); it++)
+    {
+      while (!openEnds.empty() && openEnds.back() <= it->start + kTolerance)
+        openEnds.pop_back();
+      if (!openEnds.empty() && it->end > openEnds.back() + kTolerance)
+        misnested++;
+      openEnds.push_back(it->end);
+    }
+    TEST_CHECK(misnested == 0, "%u events of thread %u end after their parent", misnested, thread->first);
+  }
+}
+
+//******************************************************
+//                Perfetto
+//******************************************************
+
+static bool ReadVarint(const uint8_t*& current, const uint8_t* end, uint64_t& value)
+{
+  value = 0;
+  for (uint32_t shift = 0; shift < 64 && current < end; shift += 7)
+  {
+    uint8_t byte = *current++;
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Calls onField(field, wireType, varint, bytes, length) for every field, false if a field doesn't fit the message
+template <typename OnField>
+static bool ForEachField(const uint8_t* data, size_t size, const OnField& onField)
+{
+  const uint8_t* current = data;
+  const uint8_t* end = data + size;
+  while (current < end)
+  {
+    uint64_t tag, value;
+    if (!ReadVarint(current, end, tag) || !ReadVarint(current, end, value))
+      return false;
+
+    uint32_t wireType = (uint32_t)(tag & 7);
+    if (wireType == 2)
+    {
+      if (value > (uint64_t)(end - current))
+        return false;
+      onField((uint32_t)(tag >> 3), wireType, 0, current, (size_t)value);
+      current += value;
+    }
+    else if (wireType == 0)
+      onField((uint32_t)(tag >> 3), wireType, value, nullptr, 0);
+    else
+      return false;
+  }
+  return true;
+}
+
+static void CheckPerfetto(uint32_t expectedTracks)
+{
+  std::string text;
+  TEST_CHECK(ReadFile(kPerfettoPath, text), "couldn't read %s", kPerfettoPath);
+  const uint8_t* data = (const uint8_t*)text.data();
+
+  // The Trace message is a list of packets, field 1, each prefixed with its length
+  uint32_t packets = 0, badPackets = 0, tracksDescribed = 0;
+  std::map<uint64_t, int64_t> openSlices; // per track uuid
+  uint32_t unbalanced = 0;
+  size_t offset = 0;
+  while (offset < text.size())
+  {
+    const uint8_t* current = data + offset;
+    const uint8_t* end = data + text.size();
+    uint64_t tag, length;
+    if (!ReadVarint(current, end, tag) || tag != ((1 << 3) | 2) || !ReadVarint(current, end, length) || length > (uint64_t)(end - current))
+    {
+      TEST_CHECK(false, "packet at offset %u has a bad header or a length past the end of the file", (uint32_t)offset);
+      break;
+    }
+
+    // Fields inside the packet have to add up to exactly its length
+    bool fieldsFit = ForEachField(current, (size_t)length, [&](uint32_t field, uint32_t, uint64_t, const uint8_t* bytes, size_t size)
+    {
+      if (field == 60)
+        tracksDescribed++;
+      if (field != 11)
+        return;
+
+      uint64_t type = 0, trackUuid = 0;
+      if (!ForEachField(bytes, size, [&](uint32_t eventField, uint32_t, uint64_t value, const uint8_t*, size_t) { if (eventField == 9) type = value; else if (eventField == 11) trackUuid = value; }))
+        badPackets++;
+      if (type == 1)
+        openSlices[trackUuid]++;
+      else if (type == 2 && --openSlices[trackUuid] < 0)
+        unbalanced++;
+    });
+    if (!fieldsFit)
+      badPackets++;
+
+    packets++;
+    offset = (size_t)(current - data) + (size_t)length;
+  }
+
+  TEST_CHECK(offset == text.size(), "the last packet ends at %u, the file is %u bytes", (uint32_t)offset, (uint32_t)text.size());
+  TEST_CHECK(badPackets == 0, "%u of %u packets have fields that don't fit their length", badPackets, packets);
+  TEST_CHECK(tracksDescribed == expectedTracks + 1, "%u track descriptors, expected the process and %u tracks", tracksDescribed, expectedTracks);
+  TEST_CHECK(unbalanced == 0, "%u slices ended before they began", unbalanced);
+  for (auto it = openSlices.begin(); it != openSlices.end(); it++)
+    TEST_CHECK(it->second == 0, "%lld slices of track %llu never ended", (long long)it->second, (unsigned long long)it->first);
+}
+
+// Names over the limit don't fit a Perfetto packet. The export has to fail and leave the packet out,
+// the ones before and after it still have to be intact
+static void CheckOversizedName()
+{
+  std::vector<Track> tracks(1);
+  tracks[0].name = std::string(TraceWriter::kMaxNameLength * 10, 'x');
+  tracks[0].threadID = 1;
+
+  TEST_CHECK(!Export(TraceWriter::kPerfetto, kPerfettoPath, tracks), "a track name too long for a packet was exported");
+  CheckPerfetto(1); // only the frame track
+  TEST_CHECK(Export(TraceWriter::kChromeJson, kJsonPath, tracks), "the JSON export failed on a long track name");
+  remove(kPerfettoPath);
+  remove(kJsonPath);
+}
+
+int main()
+{
+  std::vector<Track> tracks = MakeTracks();
+
+  TEST_CHECK(Export(TraceWriter::kChromeJson, kJsonPath, tracks), "couldn't export %s", kJsonPath);
+  CheckChromeJson(tracks);
+  TEST_CHECK(Export(TraceWriter::kPerfetto, kPerfettoPath, tracks), "couldn't export %s", kPerfettoPath);
+  CheckPerfetto((uint32_t)tracks.size() + 1);
+  remove(kJsonPath);
+  remove(kPerfettoPath);
+
+  CheckOversizedName();
+
+  return TestResult();
+}